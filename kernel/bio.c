@@ -7,6 +7,7 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+// * To read several blocks ahead of time in one go, call bprefetch.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
@@ -55,37 +56,48 @@ binit(void)
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// If every buffer is in use, wait for brelse() to free
+// one, or return 0 at once if wait is not set.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int wait)
 {
   struct buf *b;
 
   acquire(&bcache.lock);
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  for(;;){
+    // Is the block already cached?
+    for(b = bcache.head.next; b != &bcache.head; b = b->next){
+      if(b->dev == dev && b->blockno == blockno){
+        b->refcnt++;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
+    }
+
+    // Not cached.
+    // Recycle the least recently used (LRU) unused buffer.
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+      if(b->refcnt == 0) {
+        b->dev = dev;
+        b->blockno = blockno;
+        b->valid = 0;
+        b->refcnt = 1;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
     }
-  }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+    if(!wait){
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
     }
+    // look again once a buffer is free: someone may
+    // have read the block into a buffer meanwhile.
+    sleep(&bcache, &bcache.lock);
   }
-  panic("bget: no buffers");
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +106,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 1);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +114,37 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Bring the n blocks of blockno[] into the cache, reading the
+// ones that are not there yet with one batch of disk requests
+// rather than one request after another. The blocks must all be
+// different, and n at most MAXPREFETCH. Reading ahead is only a
+// hint, so it stops at the first block that finds every buffer
+// in use, rather than wait holding the ones it has.
+void
+bprefetch(uint dev, uint *blockno, int n)
+{
+  struct buf *b[MAXPREFETCH], *rd[MAXPREFETCH];
+  int i, m = 0;
+
+  if(n > MAXPREFETCH)
+    panic("bprefetch");
+
+  for(i = 0; i < n; i++){
+    if((b[i] = bget(dev, blockno[i], 0)) == 0){
+      n = i;
+      break;
+    }
+    if(!b[i]->valid)
+      rd[m++] = b[i];
+  }
+  if(m > 0)
+    virtio_disk_rwn(rd, m, 0);
+  for(i = 0; i < n; i++){
+    b[i]->valid = 1;
+    brelse(b[i]);
+  }
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -131,6 +174,7 @@ brelse(struct buf *b)
     b->prev = &bcache.head;
     bcache.head.next->prev = b;
     bcache.head.next = b;
+    wakeup(&bcache);
   }
   
   release(&bcache.lock);
@@ -146,7 +190,8 @@ bpin(struct buf *b) {
 void
 bunpin(struct buf *b) {
   acquire(&bcache.lock);
-  b->refcnt--;
+  if(--b->refcnt == 0)
+    wakeup(&bcache);
   release(&bcache.lock);
 }
 
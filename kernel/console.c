@@ -80,12 +80,13 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
-  char cbuf;
+  int c, m, done;
+  char cbuf[32];
 
   target = n;
-  acquire(&cons.lock);
-  while(n > 0){
+  done = 0;
+  while(n > 0 && !done){
+    acquire(&cons.lock);
     // wait until interrupt handler has put some
     // input into cons.buffer.
     while(cons.r == cons.w){
@@ -96,32 +97,41 @@ consoleread(int user_dst, uint64 dst, int n)
       sleep(&cons.r, &cons.lock);
     }
 
-    c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
+    // take what has arrived, up to the end of the
+    // line, into cbuf.
+    for(m = 0; m < n && m < sizeof(cbuf) && cons.r != cons.w; ){
+      c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
+
+      if(c == C('D')){  // end-of-file
+        if(m > 0 || n < target){
+          // Save ^D for next time, to make sure
+          // caller gets a 0-byte result.
+          cons.r--;
+        }
+        done = 1;
+        break;
+      }
+
+      cbuf[m++] = c;
 
-    if(c == C('D')){  // end-of-file
-      if(n < target){
-        // Save ^D for next time, to make sure
-        // caller gets a 0-byte result.
-        cons.r--;
+      if(c == '\n'){
+        // a whole line has arrived, return to
+        // the user-level read().
+        done = 1;
+        break;
       }
-      break;
     }
+    release(&cons.lock);
 
-    // copy the input byte to the user-space buffer.
-    cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    // copy the input bytes to the user-space buffer,
+    // without cons.lock since the copy may fault a
+    // page in.
+    if(either_copyout(user_dst, dst, cbuf, m) == -1)
       break;
 
-    dst++;
-    --n;
-
-    if(c == '\n'){
-      // a whole line has arrived, return to
-      // the user-level read().
-      break;
-    }
+    dst += m;
+    n -= m;
   }
-  release(&cons.lock);
 
   return target - n;
 }
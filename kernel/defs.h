@@ -7,12 +7,16 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct pagebatch;
 struct pipe;
 struct proc;
+struct procmem;
+struct ptcursor;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct VMA;
 
 // bio.c
 void            binit(void);
@@ -21,6 +25,7 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bprefetch(uint, uint*, int);
 
 // console.c
 void            consoleinit(void);
@@ -34,13 +39,21 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+struct file*    fileimage(struct inode*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 void *          mmap(void *addr, int length, int prot, int flags, struct file* f, int offset);
 int             munmap(void *addr, int length);
+void *          mremap(void *old, int oldlen, int newlen, int flags);
+int             msync(void *addr, int length, int flags);
+int             madvise(void *addr, int length, int advice);
+int             mmapfault(struct proc *p, uint64 va, int access);
+int             vmaperm(struct VMA *v);
 int             vmacopy(struct proc *p, struct proc * np);
+void            vmadrop(struct proc *p);
+void            procmemstat(struct proc *p, struct procmem *m);
 
 // fs.c
 void            fsinit(int);
@@ -58,6 +71,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            iprefetch(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -74,6 +88,14 @@ void            kinit(void);
 void            incref(void *pa);
 void            decref(void *pa);
 uint            getref(void *pa);
+void            putref(void *pa);
+int             zeromaps(void);
+void            kmemstat(int*, int*);
+void            numastat(int*, int*, int*, int*);
+void            putbatch(struct pagebatch*, void*);
+void            freebatch(struct pagebatch*);
+int             mempolicy(int);
+extern void     *zeropage;
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -81,6 +103,22 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// pagecache.c
+void            pcacheinit(void);
+uint64          pcacheget(struct inode*, uint);
+uint64          pcachelookup(struct inode*, uint);
+void            pcachefill(struct inode*, uint, uint);
+void            pcachetrunc(struct inode*);
+int             pcachereclaim(void);
+void            pcacheexec(struct inode*, uint, uint64);
+void            pcachewrite(struct inode*, uint, char*, uint);
+void            pcachestat(int*, int*);
+int             pcachehas(struct inode*, uint, uint64);
+int             pcacheisclean(struct inode*, uint, uint64);
+int             pcachepages(void);
+int             pcachedirty(struct inode*, uint, uint64);
+int             pcacheclean(struct inode*, uint, uint64);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -97,9 +135,11 @@ int             cpuid(void);
 void            exit(int);
 int             fork(void);
 int             growproc(int);
+int             growstack(struct proc*, uint64);
+void            kthread(char*, void (*)(void));
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t, uint64, uint64);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -118,6 +158,7 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 void            getpinfo(uint64);
+int             memstat(uint64);
 
 // swtch.S
 // Save current registers in old. Load from new.	
@@ -131,12 +172,40 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// ksm.c
+void            ksminit(void);
+int             ksmctl(int, int);
+void            ksmstat(int*, int*, int*, int*);
+
+// reclaim.c
+void            reclaiminit(void);
+int             reclaim(int);
+void            reclaimstat(int*, int*, int*);
+
+// rmap.c
+void            rmapinit(void);
+int             rmapadd(pte_t*, uint64);
+void            rmapdel(pte_t*, uint64);
+void            rmapmove(pte_t*, pte_t*, uint64);
+int             rmapcount(uint64);
+void            rmapstat(int*, int*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// swap.c
+void            swapinit(void);
+int             swapout(int);
+int             swapin(pagetable_t, uint64);
+void            swapdup(pte_t);
+void            swapdrop(pte_t*);
+void            swapstat(int*, int*, int*, int*);
+void            zswapstat(int*, int*, int*);
+int             swappable(struct proc*);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -177,11 +246,18 @@ pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
-void            uvmfree(pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64);
+void            uvmfree(pagetable_t, uint64, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
-void            uvmclear(pagetable_t, uint64);
+uint64          uvmasid(struct proc*);
+void            tlbflush(pagetable_t, uint64, uint64);
+void            asidstat(int*, int*);
+void            ptreapinit(void);
+int             ptcachedrain(void);
+void            ptstat(int*, int*, int*, int*);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walkcursor(struct ptcursor*, uint64, int);
+int             uvmptpages(pagetable_t);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -193,10 +269,33 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// vma.c
+void            vmainit(void);
+struct VMA*     vmaalloc(void);
+void            vmafree(struct VMA*);
+void            vmainsert(struct proc*, struct VMA*);
+void            vmaremove(struct proc*, struct VMA*);
+struct VMA*     vmalookup(struct proc*, uint64);
+struct VMA*     vmafind(struct proc*, uint64);
+uint64          vmaplace(struct proc*, uint64);
+int             vmamapped(struct proc*, uint64, uint64);
+struct VMA*     vmafirst(struct proc*);
+struct VMA*     vmanext(struct proc*, struct VMA*);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+void            virtio_disk_rwn(struct buf **, int, int);
+void            virtio_disk_pages(uint, uint*, uint64*, int, int);
+int             virtio_disk_present(uint);
+void            virtio_disk_intr(uint);
+
+// zswap.c
+void            zswapinit(void);
+int             zstore(uint64);
+void            zload(int, uint64);
+void            zfree(int);
+void            zstat(int*, int*, int*, int*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -14,6 +14,12 @@ uint64 dtb_pa = 0;
 struct cpu_info cpu_info_array[MAX_CPUS];
 int cpu_count = 0;
 
+// Rangos de memoria física y topología NUMA
+struct mem_range mem_ranges[MAX_MEM_RANGES];
+int mem_count = 0;
+int numa_count = 1;
+uint8 numa_distance[MAXNODES][MAXNODES];
+
 // Variable global con la dirección base del UART
 uint64 UART0;
 
@@ -26,6 +32,10 @@ uint64 VIRTIO0;
 // Variable global con el número de interrupción de VIRTIO
 uint64 VIRTIO0_IRQ;
 
+// Dirección base y número de interrupción del segundo VIRTIO (el disco de swap)
+uint64 VIRTIO1;
+uint64 VIRTIO1_IRQ;
+
 // Variable global con la dirección base del PLIC
 uint64 PLIC;
 
@@ -73,6 +83,17 @@ static uint32 sizeCells[MAX_DEPTH];
 static char node_stack[MAX_DEPTH][MAX_NODE_NAME];
 static int current_depth = 0;
 
+// Dirección e interrupción de cada nodo virtio_mmio, en el orden en el que aparecen
+#define MAX_VIRTIO 8
+static uint64 virtio_addr[MAX_VIRTIO];
+static uint64 virtio_irq[MAX_VIRTIO];
+static int virtio_count = 0;
+
+// Primer rango y nodo NUMA del nodo memory@ que se está leyendo: las propiedades
+// reg y numa-node-id pueden venir en cualquier orden
+static int mem_first = 0;
+static int mem_node = 0;
+
 // Declaración de funciones auxiliares
 int strcmp_custom(const char *p, const char *q);
 int strncmp_custom(const char *p, const char *q, int n);
@@ -147,6 +168,71 @@ dtb_init(void)
 
     // Parsear el árbol de dispositivos
     parse_fdt((void *)dt_struct, dt_totalsize - swap_uint32(header->off_dt_struct));
+
+    // Los dos virtio de direcciones más bajas son el disco del sistema de ficheros (VIRTIO0)
+    // y el de swap (VIRTIO1), que es como los pone QEMU: bus virtio-mmio-bus.0 y .1
+    for (int i = 0; i < virtio_count; i++) {
+        if (VIRTIO0 == 0 || virtio_addr[i] < VIRTIO0) {
+            VIRTIO1 = VIRTIO0;
+            VIRTIO1_IRQ = VIRTIO0_IRQ;
+            VIRTIO0 = virtio_addr[i];
+            VIRTIO0_IRQ = virtio_irq[i];
+        } else if (VIRTIO1 == 0 || virtio_addr[i] < VIRTIO1) {
+            VIRTIO1 = virtio_addr[i];
+            VIRTIO1_IRQ = virtio_irq[i];
+        }
+    }
+
+    // Si el DTB solo describe un virtio (como kernel/virt.dtb), el segundo está donde lo pone
+    // la máquina virt de QEMU: en la página siguiente y con la interrupción siguiente
+    if (VIRTIO1 == 0) {
+        VIRTIO1 = VIRTIO0 + PGSIZE;
+        VIRTIO1_IRQ = VIRTIO0_IRQ + 1;
+    }
+
+    // Hay tantos nodos NUMA como el mayor numa-node-id de las CPUs y la memoria, más uno
+    for (int i = 0; i < cpu_count; i++) {
+        if (cpu_info_array[i].node >= numa_count)
+            numa_count = cpu_info_array[i].node + 1;
+    }
+    for (int i = 0; i < mem_count; i++) {
+        if (mem_ranges[i].node >= numa_count)
+            numa_count = mem_ranges[i].node + 1;
+    }
+    if (numa_count > MAXNODES) {
+        panic("Too many NUMA nodes in Device Tree");
+    }
+
+    // Las distancias que no da el distance-map son las de Linux por defecto:
+    // 10 dentro de un nodo y 20 entre dos nodos distintos
+    for (int i = 0; i < MAXNODES; i++) {
+        for (int j = 0; j < MAXNODES; j++) {
+            if (numa_distance[i][j] == 0)
+                numa_distance[i][j] = i == j ? 10 : 20;
+        }
+    }
+}
+
+// Nodo NUMA del hart con identificador hart (0 si el Device Tree no lo indica)
+int
+numa_node_of_hart(uint64 hart)
+{
+    for (int i = 0; i < cpu_count; i++) {
+        if (cpu_info_array[i].reg == hart)
+            return cpu_info_array[i].node;
+    }
+    return 0;
+}
+
+// Nodo NUMA de la memoria en la dirección física pa (0 si no está en ningún rango)
+int
+numa_node_of_addr(uint64 pa)
+{
+    for (int i = 0; i < mem_count; i++) {
+        if (pa >= mem_ranges[i].base && pa - mem_ranges[i].base < mem_ranges[i].size)
+            return mem_ranges[i].node;
+    }
+    return 0;
 }
 
 // Parser del Device Tree
@@ -181,6 +267,17 @@ parse_fdt(void *dt_struct_ptr, uint32 struct_size)
                 cpu_count++;
             }
 
+            // Cada nodo virtio_mmio guarda sus propiedades en una entrada nueva
+            if (strncmp_custom(name, "virtio_mmio", 11) == 0 && virtio_count < MAX_VIRTIO) {
+                virtio_count++;
+            }
+
+            // Los rangos de un nodo memory@ empiezan en el siguiente rango libre
+            if (strncmp_custom(name, "memory@", 7) == 0) {
+                mem_first = mem_count;
+                mem_node = 0;
+            }
+
             current_depth++;
 
             // Se ponen a cero los address cells y size cells del nivel actual
@@ -202,6 +299,16 @@ parse_fdt(void *dt_struct_ptr, uint32 struct_size)
                 current_cpu = 0;
             }
 
+            // Al salir de un nodo memory@ ya se conoce el nodo NUMA de todos sus rangos
+            if (strncmp_custom(current_node, "memory@", 7) == 0) {
+                if (mem_node >= MAXNODES) {
+                    panic("Too many NUMA nodes in Device Tree");
+                }
+                for (int i = mem_first; i < mem_count; i++) {
+                    mem_ranges[i].node = mem_node;
+                }
+            }
+
             current_depth--;
             node_stack[current_depth][0] = '\0'; // Limpiar el nombre del nodo
         }
@@ -232,7 +339,7 @@ parse_fdt(void *dt_struct_ptr, uint32 struct_size)
                 }
 
                 // Procesar propiedades de VIRTIO
-                if (strncmp_custom(current_node, "virtio_mmio", 11) == 0) {
+                if (strncmp_custom(current_node, "virtio_mmio", 11) == 0 && virtio_count > 0) {
                     process_virtio_prop(prop_name, prop_value, len);
                 }
 
@@ -246,6 +353,16 @@ parse_fdt(void *dt_struct_ptr, uint32 struct_size)
                     process_cpu_prop(prop_name, prop_value, len, current_cpu);
                 }
 
+                // Procesar propiedades de memoria
+                if (strncmp_custom(current_node, "memory@", 7) == 0) {
+                    process_memory_prop(prop_name, prop_value, len);
+                }
+
+                // Procesar la matriz de distancias entre nodos NUMA
+                if (strcmp_custom(current_node, "distance-map") == 0) {
+                    process_distance_prop(prop_name, prop_value, len);
+                }
+
                 // Procesar número de address cells
                 if(strcmp_custom(prop_name, "#address-cells") == 0){
                     addressCells[current_depth] = swap_uint32(((uint32 *)prop_value)[0]);
@@ -337,10 +454,10 @@ process_virtio_prop(const char *prop_name, void *prop_value, uint32 len)
         if(len != 4*currentAddressCells + 4*currentSizeCells)
             panic("Invalid 'reg' property length for VIRTIO");
 
-        VIRTIO0 = obtainAddress(prop_value,4*currentAddressCells);
+        virtio_addr[virtio_count - 1] = obtainAddress(prop_value,4*currentAddressCells);
 
     } else if (strcmp_custom(prop_name, "interrupts") == 0) {
-        VIRTIO0_IRQ = obtainAddress(prop_value,4);
+        virtio_irq[virtio_count - 1] = obtainAddress(prop_value,4);
     }
 }
 
@@ -386,6 +503,65 @@ process_cpu_prop(const char *prop_name, void *prop_value, uint32 len, struct cpu
     } else if (strcmp_custom(prop_name, "phandle") == 0 && len >= 4) {
         uint32 phandle = swap_uint32(*(uint32 *)prop_value);
         cpu->phandle = phandle;
+    } else if (strcmp_custom(prop_name, "numa-node-id") == 0 && len >= 4) {
+        cpu->node = swap_uint32(*(uint32 *)prop_value);
+    }
+}
+
+// Procesar propiedades específicas de los nodos memory@
+void
+process_memory_prop(const char *prop_name, void *prop_value, uint32 len)
+{
+    if (strcmp_custom(prop_name, "reg") == 0) {
+        uint32 currentAddressCells;
+        uint32 currentSizeCells;
+
+        findCells(&currentAddressCells,&currentSizeCells);
+
+        // reg puede tener varios pares (dirección, tamaño)
+        uint32 entry = 4*currentAddressCells + 4*currentSizeCells;
+        if (currentSizeCells == 0 || len % entry != 0)
+            panic("Invalid 'reg' property length for memory");
+
+        for (uint32 off = 0; off < len; off += entry) {
+            if (mem_count >= MAX_MEM_RANGES) {
+                panic("Too many memory ranges in Device Tree");
+            }
+            mem_ranges[mem_count].base = obtainAddress((uint8 *)prop_value + off, 4*currentAddressCells);
+            mem_ranges[mem_count].size = obtainAddress((uint8 *)prop_value + off + 4*currentAddressCells, 4*currentSizeCells);
+            mem_ranges[mem_count].node = 0;
+            mem_count++;
+        }
+    } else if (strcmp_custom(prop_name, "numa-node-id") == 0 && len >= 4) {
+        mem_node = swap_uint32(*(uint32 *)prop_value);
+    }
+}
+
+// Procesar la propiedad distance-matrix del nodo distance-map: una lista de
+// tripletas (nodo origen, nodo destino, distancia)
+void
+process_distance_prop(const char *prop_name, void *prop_value, uint32 len)
+{
+    if (strcmp_custom(prop_name, "distance-matrix") == 0) {
+        uint32 *cells = (uint32 *)prop_value;
+
+        if (len % 12 != 0)
+            panic("Invalid 'distance-matrix' property length");
+
+        for (uint32 i = 0; i < len / 4; i += 3) {
+            uint32 from = swap_uint32(cells[i]);
+            uint32 to = swap_uint32(cells[i + 1]);
+            uint32 distance = swap_uint32(cells[i + 2]);
+
+            if (from >= MAXNODES || to >= MAXNODES) {
+                panic("Too many NUMA nodes in Device Tree");
+            }
+            numa_distance[from][to] = distance;
+
+            // Si solo se da una dirección, la distancia es la misma en la otra
+            if (numa_distance[to][from] == 0)
+                numa_distance[to][from] = distance;
+        }
     }
 }
 
@@ -4,6 +4,7 @@
 #define _DTB_H_
 
 #include "types.h"
+#include "param.h"
 
 #define MAX_CPUS 8 // Define el número máximo de harts soportados
 
@@ -14,6 +15,7 @@ extern uint64 dtb_pa;
 struct cpu_info {
     uint64 reg;      // Dirección base de la CPU
     uint32 phandle;  // Phandle de la CPU
+    int node;        // Nodo NUMA de la CPU (numa-node-id), 0 si no lo indica
     // Agrega más campos según sea necesario
 };
 
@@ -23,6 +25,25 @@ extern struct cpu_info cpu_info_array[MAX_CPUS];
 // Contador de CPUs detectadas
 extern int cpu_count;
 
+#define MAX_MEM_RANGES 8 // Número máximo de rangos de memoria física
+
+// Estructura para almacenar cada rango de memoria física (nodos memory@)
+struct mem_range {
+    uint64 base;     // Dirección física de inicio
+    uint64 size;     // Tamaño en bytes
+    int node;        // Nodo NUMA del rango (numa-node-id), 0 si no lo indica
+};
+
+// Rangos de memoria física detectados
+extern struct mem_range mem_ranges[MAX_MEM_RANGES];
+extern int mem_count;
+
+// Número de nodos NUMA (1 si el Device Tree no describe la topología)
+extern int numa_count;
+
+// Distancia entre cada par de nodos NUMA (distance-map), 10 dentro de un mismo nodo
+extern uint8 numa_distance[MAXNODES][MAXNODES];
+
 // Declaración de la función principal de inicialización del Device Tree
 void dtb_init(void);
 
@@ -32,6 +53,12 @@ void process_uart_prop(const char *prop_name, void *prop_value, uint32 len);
 void process_virtio_prop(const char *prop_name, void *prop_value, uint32 len);
 void process_plic_prop(const char *prop_name, void *prop_value, uint32 len);
 void process_cpu_prop(const char *prop_name, void *prop_value, uint32 len, struct cpu_info *cpu);
+void process_memory_prop(const char *prop_name, void *prop_value, uint32 len);
+void process_distance_prop(const char *prop_name, void *prop_value, uint32 len);
+
+// Nodo NUMA de un hart y de una dirección física
+int numa_node_of_hart(uint64 hart);
+int numa_node_of_addr(uint64 pa);
 
 // Declaración de funciones auxiliares de cadenas
 int strcmp_custom(const char *p, const char *q);
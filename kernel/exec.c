@@ -3,33 +3,31 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "kalloc.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
-int flags2perm(int flags)
-{
-    int perm = 0;
-    if(flags & 0x1)
-      perm = PTE_X;
-    if(flags & 0x2)
-      perm |= PTE_W;
-    return perm;
-}
+static int loadseg(pde_t *, uint64, struct inode *, uint, uint, int);
+static struct VMA *imgvma(uint64, uint64, int, struct file *, uint);
+static void imgdrop(pagetable_t, struct VMA **, int);
 
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+  int i, off, n, prot, nimg = 0;
+  uint64 argc, sz = 0, imgend = 0, sp, ustack[MAXARG], stackbase = 0, a, fend;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct file *f = 0;
+  struct VMA *img[2*MAXSEGS], *v;
 
   begin_op();
 
@@ -49,7 +47,13 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program's segments, rather than reading them in.
+  // The pages holding file contents become a private mapping
+  // of the file, read through the page cache on first touch
+  // (see mmapfault()), and the zero-filled rest of a segment
+  // (bss) an anonymous one. Pages that are only read, like
+  // the text, stay the page cache's, so every process running
+  // the program shares one copy of them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,29 +65,70 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < imgend)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr + ph.memsz > TRAPFRAME - (USERSTACK+1)*PGSIZE)
       goto bad;
+    if(ph.memsz == 0)
+      continue;
+    if(nimg + 2 > NELEM(img))
+      goto bad;
+    prot = PROT_READ;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      prot |= PROT_WRITE;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      prot |= PROT_EXEC;
+    fend = ph.vaddr + ph.filesz;
+    imgend = PGROUNDUP(ph.vaddr + ph.memsz);
+
+    // A segment must start a page of the file to share
+    // its pages with the page cache; if not, it is all
+    // anonymous and read now. So is a last page that the
+    // file only fills in part, which must read as zeros
+    // past filesz, not as whatever the file holds there.
+    a = ph.vaddr;
+    if(ph.off % PGSIZE == 0){
+      a = PGROUNDDOWN(fend);
+      if(a > ph.vaddr){
+        if(f == 0 && (f = fileimage(ip)) == 0)
+          goto bad;
+        if((v = imgvma(ph.vaddr, a, prot, f, ph.off)) == 0)
+          goto bad;
+        img[nimg++] = v;
+      }
+    }
+    if(a < imgend){
+      if((v = imgvma(a, imgend, prot, 0, 0)) == 0)
+        goto bad;
+      img[nimg++] = v;
+      n = fend > a ? fend - a : 0;
+      if(loadseg(pagetable, a, ip, ph.off + (a - ph.vaddr), n, vmaperm(v)) < 0)
+        goto bad;
+    }
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
+  // the mappings hold their own references.
+  if(f){
+    fileclose(f);
+    f = 0;
+  }
+
   p = myproc();
   uint64 oldsz = p->sz;
+  uint64 oldstackbot = p->stackbot;
 
-  // Allocate some pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the rest as the user stack.
-  sz = PGROUNDUP(sz);
-  uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + (USERSTACK+1)*PGSIZE, PTE_W)) == 0)
+  // Reserve USERSTACKMAX pages at the next page boundary for
+  // the user stack, and one more below them as a guard that is
+  // never mapped. Only the top USERSTACK pages are allocated
+  // now; the stack grows into the rest as it faults on them
+  // (see growstack()). The heap starts above.
+  uint64 sz1, stacktop = imgend + (USERSTACKMAX+1)*PGSIZE;
+  if((sz1 = uvmalloc(pagetable, stacktop - USERSTACK*PGSIZE, stacktop, PTE_W)) == 0)
     goto bad;
   sz = sz1;
-  uvmclear(pagetable, sz-(USERSTACK+1)*PGSIZE);
   sp = sz;
   stackbase = sp - USERSTACK*PGSIZE;
 
@@ -121,44 +166,121 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  // Unmap the old image and mappings while their
+  // page table is still the current one.
+  while(p->vmaroot)
+    munmap(p->vmaroot->addrBegin, p->vmaroot->length);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->asid = 0;  // a new ASID, so no entries of the old image survive
   p->sz = sz;
+  p->stackbot = stackbase;
+  p->stacklimit = imgend + PGSIZE;
+  for(i = 0; i < nimg; i++)
+    vmainsert(p, img[i]);
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  proc_freepagetable(oldpagetable, oldstackbot, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(f)
+    fileclose(f);
+  if(pagetable){
+    imgdrop(pagetable, img, nimg);
+    proc_freepagetable(pagetable, stackbase, sz);
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
+// Allocate a private VMA for [start, end) of a program image,
+// mapping f from offset if f is not 0, and anonymous otherwise.
+// Returns 0 if out of memory.
+static struct VMA*
+imgvma(uint64 start, uint64 end, int prot, struct file *f, uint offset)
+{
+  struct VMA *v;
+
+  if((v = vmaalloc()) == 0)
+    return 0;
+  v->addrBegin = (void*)start;
+  v->length = end - start;
+  v->prot = prot;
+  v->flags = MAP_PRIVATE | MAP_EXECUTABLE | (f ? 0 : MAP_ANONYMOUS);
+  v->offset = offset;
+  v->mappedFile = f ? filedup(f) : 0;
+  v->nextpg = offset / PGSIZE;
+  return v;
+}
+
+// Free the n image VMAs of a failed exec, and the pages
+// of theirs already mapped in pagetable.
+static void
+imgdrop(pagetable_t pagetable, struct VMA **img, int n)
+{
+  struct VMA *v;
+  struct ptcursor c = { pagetable };
+  struct pagebatch b;
+  pte_t *pte;
+  uint64 a, pa;
+  int i;
+
+  b.n = 0;
+  for(i = 0; i < n; i++){
+    v = img[i];
+    for(a = (uint64)v->addrBegin; a < (uint64)v->addrBegin + v->length; a += PGSIZE){
+      if((pte = walkcursor(&c, a, 0)) != 0 && (*pte & PTE_V)){
+        pa = PTE2PA(*pte);
+        rmapdel(pte, pa);
+        *pte = 0;
+        putbatch(&b, (void*)pa);
+      }
+    }
+    if(v->mappedFile)
+      fileclose(v->mappedFile);
+    vmafree(v);
+  }
+  freebatch(&b);
+}
+
+// Map fresh zeroed pages at virtual address va with
+// permissions perm, enough to hold sz bytes of ip from
+// offset, and read those bytes into them.
+// va must be page-aligned.
 // Returns 0 on success, -1 on failure.
 static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz, int perm)
 {
   uint i, n;
-  uint64 pa;
+  char *mem;
+  pte_t *pte;
+  struct ptcursor c = { pagetable };
 
   for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if((pte = walkcursor(&c, va + i, 1)) == 0){
+      kfree(mem);
+      return -1;
+    }
+    if(*pte & PTE_V)
+      panic("loadseg: remap");
+    if(rmapadd(pte, (uint64)mem) < 0){
+      kfree(mem);
+      return -1;
+    }
+    *pte = PA2PTE(mem) | perm | PTE_V;
     if(sz - i < PGSIZE)
       n = sz - i;
     else
       n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+    if(readi(ip, 0, (uint64)mem, offset+i, n) != n)
       return -1;
   }
   
@@ -4,6 +4,7 @@
 
 #include "types.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "param.h"
 #include "fs.h"
@@ -12,6 +13,8 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "memstat.h"
+#include "kalloc.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -55,6 +58,38 @@ filedup(struct file *f)
   return f;
 }
 
+// Return a read-only file for the image VMAs of program ip
+// (see exec()), with a new reference. Every process running
+// the program shares it, so long-running processes take one
+// file table entry per program, not one each.
+struct file*
+fileimage(struct inode *ip)
+{
+  struct file *f, *free = 0;
+
+  acquire(&ftable.lock);
+  for(f = ftable.file; f < ftable.file + NFILE; f++){
+    if(f->ref > 0 && f->image && f->ip == ip){
+      f->ref++;
+      release(&ftable.lock);
+      return f;
+    }
+    if(f->ref == 0 && free == 0)
+      free = f;
+  }
+  if((f = free) != 0){
+    f->ref = 1;
+    f->type = FD_INODE;
+    f->ip = idup(ip);
+    f->off = 0;
+    f->readable = 1;
+    f->writable = 0;
+    f->image = 1;
+  }
+  release(&ftable.lock);
+  return f;
+}
+
 // Close file f.  (Decrement ref count, close when reaches 0.)
 void
 fileclose(struct file *f)
@@ -71,6 +106,7 @@ fileclose(struct file *f)
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
+  f->image = 0;
   release(&ftable.lock);
 
   if(ff.type == FD_PIPE){
@@ -224,6 +260,71 @@ inodeinsert(struct file *f, uint64 addr, int n, uint64 offset)
   return ret;
 }
 
+// Permisos de las PTE de las páginas de la VMA v, según su protección. Las páginas de los mapeos
+// compartidos no se llevan nunca a swap (PTE_NS): cada proceso traería de vuelta su propia copia
+int
+vmaperm(struct VMA *v)
+{
+  return PTE_U | (v->prot & PROT_READ ? PTE_R : 0) | (v->prot & PROT_WRITE ? PTE_W : 0) |
+         (v->prot & PROT_EXEC ? PTE_X : 0) | (v->flags & MAP_SHARED ? PTE_NS : 0);
+}
+
+// MAP_POPULATE: en vez de esperar a los fallos de página, se traen ya todas las páginas de la VMA
+// v y se mapean de una pasada. Las del fichero se leen con pcachefill, de varios bloques a la vez,
+// por tandas de MAXPREFETCH bloques que se mapean antes de leer la siguiente. Las páginas privadas
+// en las que se puede escribir se copian ya, como haría el primer fallo de escritura. Si se acaba
+// la memoria se deja de rellenar y el resto se trae bajo demanda como siempre.
+static void
+mmappopulate(struct proc *p, struct VMA *v)
+{
+  uint64 start = (uint64)v->addrBegin;
+  uint64 end = start + v->length;
+  uint64 a, pa;
+  struct inode *ip = v->mappedFile ? v->mappedFile->ip : 0;
+  int perm = vmaperm(v);
+  uint pgno, chunk = MAXPREFETCH / (PGSIZE/BSIZE);
+  char *mem;
+  pte_t *pte;
+
+  if(ip)
+    ilock(ip);
+  for(a = start; a < end; a += PGSIZE){
+    // Los mapeos anónimos compartidos ya están rellenos, y si hay que pedir memoria puede que
+    // alguna de las páginas ya rellenas se haya ido a swap
+    if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & (PTE_V|PTE_SW)))
+      continue;
+
+    if(ip == 0){
+      if((mem = kalloc()) == 0)
+        break;
+      memset(mem, 0, PGSIZE);
+      pa = (uint64)mem;
+    } else {
+      pgno = (v->offset + (a - start)) / PGSIZE;
+      if((a - start) / PGSIZE % chunk == 0)
+        pcachefill(ip, pgno, chunk);
+      if((pa = pcacheget(ip, pgno)) == 0)
+        break;
+      if((v->flags & MAP_PRIVATE) && (v->prot & PROT_WRITE)){
+        if((mem = kalloc()) == 0){
+          putref((void*)pa);
+          break;
+        }
+        memmove(mem, (void*)pa, PGSIZE);
+        putref((void*)pa);
+        pa = (uint64)mem;
+      }
+    }
+
+    if(mappages(p->pagetable, a, PGSIZE, pa, perm) != 0){
+      putref((void*)pa);
+      break;
+    }
+  }
+  if(ip)
+    iunlock(ip);
+}
+
 void *
 mmap(void *addr, int length, int prot, int flags, struct file* f, int offset){
 
@@ -232,161 +333,759 @@ mmap(void *addr, int length, int prot, int flags, struct file* f, int offset){
     return ((void*)(char*) -1);
   }
 
+  // MAP_EXECUTABLE solo lo pone exec en las VMAs de la imagen del programa, y MAP_MERGEABLE madvise
+  flags &= ~(MAP_EXECUTABLE | MAP_MERGEABLE);
+
+  // Los mapeos anónimos no tienen fichero (f es 0) y empiezan en el offset 0
+  if(flags & MAP_ANONYMOUS){
+    f = 0;
+    offset = 0;
+  }
+
+  // Solo se mapean ficheros normales, y desde el principio de una página para que el mapeo
+  // pueda usar las páginas de la caché de páginas tal cual
+  if(f && (f->type != FD_INODE || offset < 0 || offset % PGSIZE != 0)){
+    return ((void*)(char*) -1);
+  }
+
   // Si un fichero se mapea de forma compartida y no se puede escribir, tampoco se puede
   // en su mapeo
-  if(!(f->writable) && (flags & MAP_SHARED) && (prot & PROT_WRITE)){
+  if(f && !(f->writable) && (flags & MAP_SHARED) && (prot & PROT_WRITE)){
     return ((void*)(char*) -1);
   }
 
   struct proc* p = myproc();
 
-  int vmaIndex = 0;
-
-  // Encontrar una VMA vacía
-  while(p->vmas[vmaIndex].used && vmaIndex < MAX_VMAS){
-    vmaIndex++;
+  // Se pide un descriptor de VMA nuevo (no hay más límite que MAX_VMAS y la memoria)
+  if(p->nvmas >= MAX_VMAS){
+    return ((void*)(char*) -1);
   }
-
-  // No hay VMAs disponibles
-  if(vmaIndex >= MAX_VMAS){
+  struct VMA * chosenVMA = vmaalloc();
+  if(chosenVMA == 0){
     return ((void*)(char*) -1);
   }
 
-  struct VMA * chosenVMA = &(p->vmas[vmaIndex]);
-
   // Se rellena todo lo que sabemos de momento
   chosenVMA->length = length;
   chosenVMA->prot = prot;
   chosenVMA->flags = flags;
   chosenVMA->offset = offset;
   chosenVMA->mappedFile = f;
-  chosenVMA->used = 1;
+  chosenVMA->nextpg = offset / PGSIZE;
+  chosenVMA->ra = 0;
 
-  // Se comprueba la dirección de memoria de la VMA más reciente; aquella con VA más baja.
-  // Empieza buscando por la VA más alta, quitando la página trampolín y el trapframe.
-  // Nos estaríamos colocando justo debajo del trapframe.
-  void* addrLowestVMA = (void*)(MAXVA - 2*PGSIZE);
-
-  for(int i=0;i<MAX_VMAS;i++){
-    if(i == vmaIndex) continue;
-    if(p->vmas[i].used && p->vmas[i].addrBegin < addrLowestVMA)
-      addrLowestVMA = p->vmas[i].addrBegin;
+  // Se busca sitio para la VMA: justo debajo del trapframe si cabe, y si no en el primer
+  // hueco (de arriba abajo) que hayan dejado los munmap anteriores, o por debajo de todas.
+  // Esto se puede hacer así porque hemos comprobado al principio que length es múltiplo del
+  // tamaño de página y distinto de cero
+  uint64 va = vmaplace(p, length);
+  if(va == 0){
+    vmafree(chosenVMA);
+    return ((void*)(char*) -1);
   }
-
-  // En addrLowestVMA tenemos la dirección alineada al tamaño de página donde está la VMA de más
-  // abajo. Colocaremos la siguiente justo debajo. Esto se puede hacer así porque hemos comprobado
-  // al principio que length es múltiplo del tamaño de página y distinto de cero
-  chosenVMA->addrBegin = addrLowestVMA-length;
-  if(DEBUG) printf("DEBUG: mmap: Lazy mmap of pid %d at idx %d, addrBegin: %p, len: %d, pages: %d\n",p->pid, vmaIndex, chosenVMA->addrBegin, chosenVMA->length, chosenVMA->length/PGSIZE);
+  chosenVMA->addrBegin = (void*)va;
+  vmainsert(p, chosenVMA);
+  if(DEBUG) printf("DEBUG: mmap: Lazy mmap of pid %d, addrBegin: %p, len: %d, pages: %d\n",p->pid, chosenVMA->addrBegin, chosenVMA->length, chosenVMA->length/PGSIZE);
 
   // Es importante aumentar el número de referencias del fichero para que no sea liberado cuando
   // se cierre pero aún permanezca la VMA mapeada
-  filedup(f);
+  if(f)
+    filedup(f);
+
+  // Un mapeo anónimo compartido no tiene fichero del que volver a leer las páginas, así que
+  // para que padre e hijos vean las mismas se reservan ya todas (llenas de ceros); fork()
+  // las comparte en vmacopy. Los privados sí se reservan bajo demanda.
+  if(!f && (flags & MAP_SHARED)){
+    int perm = vmaperm(chosenVMA);
+    for(uint64 a = (uint64)chosenVMA->addrBegin; a < (uint64)chosenVMA->addrBegin + length; a += PGSIZE){
+      char *mem = kalloc();
+      if(mem == 0 || mappages(p->pagetable, a, PGSIZE, (uint64)mem, perm) != 0){
+        if(mem)
+          kfree(mem);
+        munmap(chosenVMA->addrBegin, length);
+        return ((void*)(char*) -1);
+      }
+      memset(mem, 0, PGSIZE);
+    }
+  }
+
+  // En vez de mapear aquí el contenido del fichero, se deja para después (lazy alloc), salvo
+  // que se pida MAP_POPULATE
+  if(flags & MAP_POPULATE)
+    mmappopulate(p, chosenVMA);
 
-  // En vez de mapear aquí el contenido del fichero, se deja para después (lazy alloc)
   return chosenVMA->addrBegin;
 }
 
-int
-munmap(void *addr, int length){
+// Ajusta la ventana de lectura anticipada de la VMA según el patrón de acceso y trae a la caché
+// de páginas las páginas del fichero que siguen a pgno. Si el fallo cae justo donde acabó el
+// anterior, el acceso es secuencial y la ventana se duplica (hasta MAXREADAHEAD); si no, es
+// aleatorio y no se lee nada por adelantado. Si el proceso ha avisado con madvise, se hace caso
+// al aviso: MADV_RANDOM no lee nada y MADV_SEQUENTIAL lee siempre la ventana máxima.
+// Hay que tener el cerrojo de ip.
+static void
+mmapreadahead(struct VMA *v, struct inode *ip, uint pgno)
+{
+  uint last;
 
-  if(length == 0) return 0;
-  // Evitar con PGSIZE que un desmapeo de 1 pag desmapee 2.
-  if(length % PGSIZE == 0) length -= 1;
+  if(v->advice == MADV_RANDOM)
+    v->ra = 0;
+  else if(v->advice == MADV_SEQUENTIAL)
+    v->ra = MAXREADAHEAD;
+  else if(pgno == v->nextpg)
+    v->ra = v->ra == 0 ? MINREADAHEAD : (2*v->ra > MAXREADAHEAD ? MAXREADAHEAD : 2*v->ra);
+  else
+    v->ra = 0;
 
-  // #1. Obtener la VMA que contiene la dirección addr
-  struct proc* p = myproc();
-  int idx = 0;
-  struct VMA *v;
+  // Sin pasarse del final del mapeo (pcachefill ya no pasa del final del fichero), y leyendo
+  // del disco varios bloques a la vez
+  last = pgno + v->ra;
+  if(last >= (v->offset + v->length) / PGSIZE)
+    last = (v->offset + v->length) / PGSIZE - 1;
+  if(last > pgno)
+    pcachefill(ip, pgno + 1, last - pgno);
+}
 
-  // Direcciones del primer y último bloque que contiene el rango a liberar
-  uint64 start_pg = PGROUNDDOWN((uint64)addr);
-  uint64 end_pg = PGROUNDDOWN((uint64)addr+length); 
-
-  // Buscamos la VMA que contiene el bloque en cuestión
-  while(idx < MAX_VMAS){
-    v = &p->vmas[idx];
-    if(v->used == 1){
-      uint64 addrFinal = (uint64)v->addrBegin + v->length;
-      uint64 addrInicial = (uint64)v->addrBegin;
-      if(addrInicial <= start_pg && end_pg <= addrFinal) // Encontramos la vma
-      break;
+// Fault-around: mapea de una vez las páginas vecinas de va que ya están en la caché de páginas
+// y que el proceso aún no tiene, para ahorrarse sus fallos de página. Se miran el bloque alineado
+// de FAULTAROUND páginas que contiene va y la ventana de lectura anticipada. Al acabar, nextpg
+// apunta a la primera página tras va que sigue sin mapear, que es donde fallará un recorrido
+// secuencial. Hay que tener el cerrojo de ip.
+static void
+mmapfaultaround(struct proc *p, struct VMA *v, struct inode *ip, uint64 va, int perm)
+{
+  uint64 start = (uint64)v->addrBegin;
+  uint64 end = start + v->length;
+  uint64 lo = va & ~((uint64)FAULTAROUND*PGSIZE - 1);
+  uint64 hi = lo + FAULTAROUND*PGSIZE;
+  uint64 next = va + PGSIZE;
+  uint64 a, pa;
+  pte_t *pte;
+
+  if(hi < va + (v->ra + 1)*PGSIZE)
+    hi = va + (v->ra + 1)*PGSIZE;
+  if(lo < start)
+    lo = start;
+  if(hi > end)
+    hi = end;
+
+  // En los mapeos privados las páginas de la caché nunca se mapean con PTE_W
+  if(v->flags & MAP_PRIVATE)
+    perm &= ~PTE_W;
+
+  for(a = lo; a < hi; a += PGSIZE){
+    if(a == va)
+      continue;
+    if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & (PTE_V|PTE_SW)) == 0){
+      if((pa = pcachelookup(ip, (v->offset + (a - start)) / PGSIZE)) == 0)
+        continue;
+      if(mappages(p->pagetable, a, PGSIZE, pa, perm) != 0){
+        putref((void*)pa);
+        break;
+      }
+      if(v->flags & MAP_EXECUTABLE)
+        pcacheexec(ip, (v->offset + (a - start)) / PGSIZE, pa);
     }
-    idx++;
+    if(a == next)
+      next += PGSIZE;
   }
 
+  v->nextpg = (v->offset + (next - start)) / PGSIZE;
+}
+
+// Atiende un fallo de página en la dirección va del proceso p. access es el acceso que ha fallado:
+// PROT_READ, PROT_WRITE o PROT_EXEC. Devuelve -1 si va no está en ninguna VMA o la VMA no permite
+// ese acceso, o si no queda memoria (y entonces hay que matar al proceso), y 0 si la página ya se
+// puede usar.
+int
+mmapfault(struct proc *p, uint64 va, int access)
+{
+  void* faultAddr = (void*)(va & ~(PGSIZE-1));
+  int write = (access == PROT_WRITE);
+  int r;
+
+  // La página puede estar en swap, sea del heap, de la pila o de una VMA: se trae de vuelta con
+  // los permisos que tenía (ver swap.c). Si aun así no permite el acceso (por ejemplo, es una
+  // escritura en una página COW), la instrucción volverá a fallar y se atenderá como siempre
+  if((r = swapin(p->pagetable, (uint64)faultAddr)) != 0)
+    return r < 0 ? -1 : 0;
+
+  // O puede estar en la parte de la región de la pila a la que esta aún no ha llegado: la pila
+  // crece hasta esa página (ver growstack()). Por debajo del límite queda la página de guarda
+  if((r = growstack(p, va)) != 0)
+    return r < 0 ? -1 : 0;
+
+  // Si no, se comprueba si la dirección que ha dado fallo (stval) está dentro de alguna VMA
+  // (se saca la dirección del primer byte de la página en la que se encuentra para simplificar)
+  struct VMA * v = vmalookup(p, (uint64)faultAddr);
+
   // La dirección no pertenece a ninguna VMA
-  if(idx >= MAX_VMAS){
+  if(v == 0)
+    return -1;
+
+  // Comprobar si el fallo viene dado por falta de permisos.
+  if((v->prot & PROT_NONE) || !(v->prot & access))
     return -1;
+
+  p->faults++;
+
+  pte_t *pte = walk(p->pagetable, (uint64)faultAddr, 1);
+  uint64 pa = walkaddr(p->pagetable, (uint64)faultAddr);
+  int perm = vmaperm(v);
+
+  if(pte == 0)
+    return -1;
+
+  // La página ya está mapeada con los permisos que hacen falta (por ejemplo, otro fallo
+  // la ha traído antes): no hay nada que hacer
+  if(pa != 0 && (!write || (*pte & PTE_W)))
+    return 0;
+
+  // Caso COW: Existe PA asociada a la VA, se puede escribir 
+  // en el mapeo pero no en la VA asociada a la PTE del proceso.
+  if(pa != 0){
+    // Caso especial asociado a desmapeo por COW.
+    // Se queda la PA antigua con una sola referencia, activar PTE_W.
+    if(getref((void*)pa) == 1){
+      if(DEBUG) printf("DEBUG: usertrap: COW, special case, activating PTE_W.\n");
+      // La PTE sigue apuntando a la misma PA, y sigue en el mapa inverso: se cambia en el sitio
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      tlbflush(p->pagetable, (uint64)faultAddr, 1);
+    } else {
+      // Caso general.
+      // Nueva PA para el proceso actual. -> activar PTE_W.
+      // Decrementar referencia a la antigua PA.
+      // Si tras esto la antigua PA solo tiene una referencia 
+      // activar PTE_W (cuando intente escribir el otro proceso
+      // que aún la usa, es el caso especial de arriba).
+      // Mientras kalloc busca memoria, que puede suponer llevar páginas a swap, la antigua PA se
+      // retiene con una referencia más: si el otro proceso la suelta, no se la lleva por el camino
+      if(DEBUG) printf("DEBUG: usertrap: COW, removing mapping with new PA.\n");
+      incref((void*)pa);
+      char *newPa = (char*)kalloc();
+
+      if(newPa == 0){
+        putref((void*)pa);
+        return -1;
+      }
+
+      memmove((void*)newPa, (void*)pa, PGSIZE);
+      // La PTE pasa de una PA a otra en el mapa inverso (ver rmap.c). La entrada nueva se pide
+      // antes de tocar nada: si no hay memoria para ella, la PTE se queda como estaba
+      if(rmapadd(pte, (uint64)newPa) < 0){
+        kfree(newPa);
+        putref((void*)pa);
+        return -1;
+      }
+      rmapdel(pte, pa);
+      *pte = PA2PTE(newPa) | perm | PTE_V;
+      tlbflush(p->pagetable, (uint64)faultAddr, 1);
+      putref((void*)pa);
+      putref((void*)pa);
+      if(DEBUG) printf("DEBUG: usertrap: mappages success. PA: %p\n", (void *)newPa);
+    }
+    return 0;
+  }
+
+  if(DEBUG) printf("DEBUG: usertrap: Lazy alloc miss of pid %d at dir %p, mapping...\n", p->pid, faultAddr);
+
+  // Mapeo anónimo: basta con una página nueva llena de ceros
+  if(v->mappedFile == 0){
+    // Si es privado y solo se lee, ni eso: se mapea sin PTE_W la página de ceros que comparte
+    // todo el sistema, y la primera escritura se la copia como en el COW (ver kalloc.c)
+    if(!write && (v->flags & MAP_PRIVATE)){
+      incref(zeropage);
+      if(mappages(p->pagetable, (uint64)faultAddr, PGSIZE, (uint64)zeropage, perm & ~PTE_W) != 0)
+        putref(zeropage);
+      return 0;
+    }
+    char *mem = (char*)kalloc();
+    if(mem == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(mappages(p->pagetable, (uint64)faultAddr, PGSIZE, (uint64)mem, perm) != 0)
+      kfree(mem);
+    return 0;
   }
 
-  // No permitir agujeros en la VMA
-  if(addr != v->addrBegin && 
-      (addr+length != v->addrBegin + v->length)){
+  // Si la dirección pertenece a una VMA, se pide la página a la caché de páginas del fichero,
+  // que la lee de disco solo si nadie la tenía ya. Tenemos que obtener el cerrojo del fichero primero
+  struct inode* inodeptr = v->mappedFile->ip;
+  uint64 fileOffset = (uint64)(v->offset + (faultAddr-v->addrBegin));
+
+  // Si el fallo viene de una copyin/copyout de read() o write() sobre el mismo fichero, su
+  // cerrojo ya es nuestro y esperar a tenerlo sería esperar para siempre: la llamada falla
+  if(holdingsleep(&inodeptr->lock))
     return -1;
-  } 
 
-  
+  ilock(inodeptr);
+  char *physPage = (char*)pcacheget(inodeptr, fileOffset/PGSIZE);
+  if(physPage == 0){
+    iunlock(inodeptr);
+    return -1;
+  }
 
-  // #2 Borrar mapeo con addr y length
-  // Comprobar por cada página si es mapeo compartido y escribir en disco 
-  for(uint64 i = start_pg; i <= end_pg; i+=PGSIZE){
-    // Lazy alloc puede dar lugar a la existencia de páginas no 
-    // válidas si aún no han sido accedidas, debemos comprobar eso
-    uint64 pa = 0;
-    if((pa = walkaddr(p->pagetable, i)) != 0) {
-      if(getref((void*)pa) == 1){
-        if(v->flags & MAP_SHARED){
-          struct file *f = v->mappedFile;
-          begin_op();
-          ilock(f->ip);
-          // No se puede usar filewrite, altera el offset y 
-          // el mapeo deja de ser transparente para el usuario.
-          writei(f->ip, 1, i, v->offset+(i-(uint64)(v->addrBegin)), PGSIZE);
-          iunlock(f->ip);
-          end_op();
-        }
-        // El último param hace kfree. Solo usarlo si ref == 1
-        uvmunmap(p->pagetable, i, 1, 1);
-        if(DEBUG) printf("DEBUG: munmap: Valid PTE free'd of pid %d at idx %d, dir: %p\n",p->pid, idx, (void*)i);
+  // Se aprovecha el viaje a disco para leer por adelantado lo que vendrá después
+  mmapreadahead(v, inodeptr, fileOffset/PGSIZE);
+
+  // Los mapeos compartidos usan directamente la página de la caché, así todos los procesos que
+  // mapean el fichero ven las mismas páginas físicas. Los privados también la comparten mientras
+  // solo se lea (sin PTE_W, como en el COW); si el primer acceso es una escritura se copia ya.
+  int pageperm = perm;
+  if(v->flags & MAP_PRIVATE){
+    if(write){
+      char *cached = physPage;
+      if((physPage = (char*)kalloc()) == 0){
+        putref(cached);
+        iunlock(inodeptr);
+        return -1;
       }
-      else{
-        // Desmapear la página del proceso, sin liberar la PA, 
-        //puesto que hay otros procesos con mapeos que la referencian, 
-        // si no quedan hojas y da panic en freewalk.
-        decref((void*)pa);
-        uvmunmap(p->pagetable, i, 1, 0);
-        if(DEBUG) printf("DEBUG: munmap: Valid PTE with multiple references free'd of pid %d at idx %d, dir: %p\n",p->pid, idx, (void*)i);
+      memmove(physPage, cached, PGSIZE);
+      putref(cached);
+    } else {
+      pageperm &= ~PTE_W;
+      // Las páginas de la imagen de un programa las comparten todos los procesos que lo ejecutan:
+      // se marcan en la caché para que escribir en el fichero no les cambie el código (ver exec.c)
+      if(v->flags & MAP_EXECUTABLE)
+        pcacheexec(inodeptr, fileOffset/PGSIZE, (uint64)physPage);
+    }
+  }
+
+  // Ahora que se tiene el contenido en una página física, tenemos que mapearla a una
+  // página virtual en el proceso
+  if(mappages(p->pagetable,(uint64)faultAddr,PGSIZE,(uint64)physPage,pageperm) == 0){
+    if(DEBUG) printf("DEBUG: usertrap: mappages success. PA: %p\n", (void *)physPage);
+  } else {
+    if(DEBUG) printf("DEBUG: usertrap: mappages error.\n");
+  }
+
+  // Y de paso las vecinas que ya estén en la caché, salvo que el proceso haya avisado de que
+  // accede al azar (MADV_RANDOM): entonces no le sirven y solo ocuparían memoria
+  if(v->advice != MADV_RANDOM)
+    mmapfaultaround(p, v, inodeptr, (uint64)faultAddr, perm);
+  iunlock(inodeptr);
+  return 0;
+}
+
+// Páginas de un mapeo que se escriben en una misma transacción del log: sus bloques, más el
+// inodo y uno de holgura, tienen que caber en MAXOPBLOCKS.
+#define WBPAGES (((MAXOPBLOCKS-2)*BSIZE)/PGSIZE)
+
+// Escribe en disco las n páginas físicas de pa[], que son páginas seguidas de un mapeo compartido
+// y la primera empieza en el byte off del fichero, todas en la misma transacción del log. No se
+// escribe más allá del final del fichero: el mapeo no lo hace crecer.
+static void
+mmapwriteback(struct file *f, uint64 *pa, int n, uint off)
+{
+  uint m;
+
+  begin_op();
+  ilock(f->ip);
+  for(int i = 0; i < n && off < f->ip->size; i++, off += PGSIZE){
+    m = f->ip->size - off;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    // No se puede usar filewrite, altera el offset y 
+    // el mapeo deja de ser transparente para el usuario.
+    writei(f->ip, 0, pa[i], off, m);
+    myproc()->wbpages++;
+  }
+  iunlock(f->ip);
+  end_op();
+}
+
+// Recoge las páginas de [start, end) que se han modificado desde la última vez en v, un mapeo
+// compartido de fichero. El hardware pone PTE_D al escribir en una página (copyout()
+// también, si escribe el kernel) y aquí se borra.
+// Con MS_SYNC se escriben en disco, y las que están seguidas van juntas, WBPAGES por transacción.
+// Si no, la marca pasa a la caché de páginas (que es donde está la página) y se vuelve enseguida;
+// ya la escribirá un msync(MS_SYNC) o munmap, de este proceso o de cualquier otro que la mapee.
+static void
+mmapsync(struct proc *p, struct VMA *v, uint64 start, uint64 end, int flags)
+{
+  struct inode *ip = v->mappedFile->ip;
+  uint64 batch[WBPAGES], pa;
+  uint off = 0, pgno;
+  int n = 0, dirty;
+  pte_t *pte;
+  struct ptcursor c = { p->pagetable };
+
+  for(uint64 a = start; a < end; a += PGSIZE){
+    pgno = (v->offset + (a - (uint64)v->addrBegin)) / PGSIZE;
+    if((pte = walkcursor(&c, a, 0)) == 0 || (*pte & PTE_V) == 0){
+      dirty = 0;
+    } else {
+      pa = PTE2PA(*pte);
+      dirty = (*pte & PTE_D) != 0;
+      *pte &= ~PTE_D;
+      if(!(flags & MS_SYNC)){
+        // Si la página no es la de la caché (se truncó el fichero después), la marca se queda aquí
+        if(dirty && !pcachedirty(ip, pgno, pa))
+          *pte |= PTE_D;
+        continue;
       }
+      dirty |= pcacheclean(ip, pgno, pa);
+      if(dirty){
+        if(n == 0)
+          off = pgno * PGSIZE;
+        batch[n++] = pa;
+      }
+    }
+    if(n > 0 && (!dirty || n == WBPAGES)){
+      mmapwriteback(v->mappedFile, batch, n, off);
+      n = 0;
+    }
+  }
+  if(n > 0)
+    mmapwriteback(v->mappedFile, batch, n, off);
+
+  // Que la TLB no recuerde PTE_D puesto: la próxima escritura lo tiene que volver a poner
+  tlbflush(p->pagetable, start, (end - start) / PGSIZE);
+}
+
+// Quita del proceso las páginas ya mapeadas de [start, end) de la VMA v y suelta su referencia a
+// la PA. Solo se libera si era la última (ni otros procesos ni la caché de páginas la usan). Con
+// writeback, las páginas modificadas de un mapeo compartido de fichero se escriben antes en disco.
+// Las referencias se sueltan por lotes, para no coger el cerrojo del asignador en cada página.
+static void
+munmappages(struct proc *p, struct VMA *v, uint64 start, uint64 end, int writeback)
+{
+  uint64 pa;
+  pte_t *pte;
+  struct ptcursor c = { p->pagetable };
+  struct pagebatch b;
+
+  b.n = 0;
+
+  // En un mapeo compartido la página es la de la caché de páginas, que también ven los
+  // demás procesos y read(); se escribe en disco para que el cambio no se pierda.
+  if(writeback && (v->flags & MAP_SHARED) && v->mappedFile)
+    mmapsync(p, v, start, end, MS_SYNC);
+
+  // Las PTE se recorren con un cursor, que solo baja desde la raíz al cambiar de página de
+  // tabla hoja, y se borran directamente: la TLB se invalida una vez al final, para todo el rango
+  for(uint64 i = start; i < end; i += PGSIZE){
+    // Lazy alloc puede dar lugar a la existencia de páginas no 
+    // válidas si aún no han sido accedidas, debemos comprobar eso
+    if((pte = walkcursor(&c, i, 0)) != 0 && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U)) {
+      pa = PTE2PA(*pte);
+      rmapdel(pte, pa);
+      *pte = 0;
+      putbatch(&b, (void*)pa);
+      if(DEBUG) printf("DEBUG: munmap: Valid PTE free'd of pid %d, dir: %p\n",p->pid, (void*)i);
+    } else if(pte != 0 && (*pte & PTE_SW)) {
+      // La página estaba en swap: basta con soltar su hueco
+      swapdrop(pte);
     } else {
-      if(DEBUG) printf("DEBUG: munmap: Lazy PTE free'd of pid %d at idx %d, dir: %p\n",p->pid, idx, (void*)i);
+      if(DEBUG) printf("DEBUG: munmap: Lazy PTE free'd of pid %d, dir: %p\n",p->pid, (void*)i);
     }
-    // Si borramos la primera página de la vma, hay que poner la siguiente como dir de inicio
-    // En caso de borrar todo, no pasa nada por que apunte a una dir incorrecta, ya que se borrará
-    // todo al liberar la estructura en el el punto #3
-    if(i == (uint64)v->addrBegin) {
-      v->addrBegin += PGSIZE;
-      v->offset += PGSIZE;
+  }
+  tlbflush(p->pagetable, start, (end - start) / PGSIZE);
+  freebatch(&b);
+}
+
+// Parte la VMA v en dos por la dirección a, que tiene que caer dentro de v y no en su principio.
+// Devuelve la VMA de la mitad de arriba, que es nueva y tiene su propia referencia al fichero,
+// o 0 si no se ha podido partir. La de abajo sigue siendo v.
+static struct VMA*
+vmasplit(struct proc *p, struct VMA *v, uint64 a)
+{
+  struct VMA *nv;
+  uint64 vstart = (uint64)v->addrBegin;
+
+  if(p->nvmas >= MAX_VMAS || (nv = vmaalloc()) == 0)
+    return 0;
+
+  // Se saca v del árbol mientras cambian sus direcciones
+  vmaremove(p, v);
+  *nv = *v;
+  nv->addrBegin = (void*)a;
+  nv->length = vstart + v->length - a;
+  nv->offset += a - vstart;
+  if(nv->mappedFile)
+    filedup(nv->mappedFile);
+  v->length = a - vstart;
+  vmainsert(p, v);
+  vmainsert(p, nv);
+  return nv;
+}
+
+// Parte las VMAs de p que cruzan start o end, para que [start, end) quede cubierto por VMAs enteras.
+// Devuelve la primera VMA del rango, o 0 si no hay ninguna o no se ha podido partir.
+static struct VMA*
+vmaclip(struct proc *p, uint64 start, uint64 end)
+{
+  struct VMA *v, *last;
+
+  v = vmafind(p, start);
+  if(v == 0 || (uint64)v->addrBegin >= end)
+    return 0;
+  if(start > (uint64)v->addrBegin && (v = vmasplit(p, v, start)) == 0)
+    return 0;
+  last = vmalookup(p, end - 1);
+  if(last && end < (uint64)last->addrBegin + last->length && vmasplit(p, last, end) == 0)
+    return 0;
+  return v;
+}
+
+int
+munmap(void *addr, int length){
+
+  if(length == 0) return 0;
+  if(length < 0) return -1;
+
+  struct proc* p = myproc();
+  struct VMA *v, *next;
+
+  // Direcciones del primer bloque del rango a liberar y del primero que ya no se libera
+  uint64 start = PGROUNDDOWN((uint64)addr);
+  uint64 end = PGROUNDUP((uint64)addr + length);
+
+  // #1. Obtener la primera VMA que se solapa con el rango. El rango puede abarcar varias VMAs y
+  // dejar huecos en ellas, pero tiene que tocar al menos una. Las VMAs de los extremos se parten,
+  // así que si el rango cae en medio de una VMA, la VMA se queda en dos trozos.
+  if((v = vmaclip(p, start, end)) == 0){
+    return -1;
+  }
+
+  for(; v && (uint64)v->addrBegin < end; v = next){
+    next = vmanext(p, v);
+
+    // #2. Borrar el mapeo de las páginas de la VMA, escribiendo en disco si es compartido
+    munmappages(p, v, (uint64)v->addrBegin, (uint64)v->addrBegin + v->length, 1);
+
+    // #3. Liberar fichero y descriptor
+    vmaremove(p, v);
+    if(v->mappedFile)
+      fileclose(v->mappedFile);
+    vmafree(v);
+  }
+
+  return 0;
+}
+
+// Mueve las PTE de las páginas de [from, from+len) a [to, to+len), sin tocar las páginas: las que
+// están en memoria siguen en el mismo sitio y las que están en swap en el mismo hueco. Antes se
+// crean todas las tablas de páginas que hacen falta en el destino, para no fallar a medias.
+// Devuelve 0, o -1 si no hay memoria para ellas.
+static int
+mremapmove(struct proc *p, uint64 from, uint64 to, uint64 len)
+{
+  struct ptcursor oc = { p->pagetable }, nc = { p->pagetable };
+  pte_t *pte, *npte;
+  uint64 i;
+
+  for(i = 0; i < len; i += PGSIZE)
+    if(walkcursor(&nc, to + i, 1) == 0)
+      return -1;
+
+  for(i = 0; i < len; i += PGSIZE){
+    if((pte = walkcursor(&oc, from + i, 0)) == 0 || (*pte & (PTE_V|PTE_SW)) == 0)
+      continue;
+    npte = walkcursor(&nc, to + i, 0);
+    if(*pte & PTE_V)
+      rmapmove(pte, npte, PTE2PA(*pte));
+    *npte = *pte;
+    *pte = 0;
+  }
+  tlbflush(p->pagetable, from, len / PGSIZE);
+  tlbflush(p->pagetable, to, len / PGSIZE);
+  return 0;
+}
+
+// Cambia a newlen bytes el tamaño del mapeo [old, old+oldlen), que tiene que caer dentro de una
+// sola VMA. Encoger suelta las páginas del final, como munmap. Para crecer, la VMA se alarga en el
+// sitio si encima hay hueco; si no lo hay y flags lleva MREMAP_MAYMOVE, se lleva a un hueco donde
+// quepa moviendo las PTE, no los datos: ninguna página se copia ni se vuelve a leer del disco, y el
+// coste es el de recorrer las PTE. Las VMAs de la imagen del programa no se pueden cambiar.
+// Devuelve la dirección del mapeo, o -1.
+void *
+mremap(void *old, int oldlen, int newlen, int flags){
+  struct proc *p = myproc();
+  struct VMA *v, *next;
+  uint64 start = (uint64)old, end = start + oldlen, nstart, a;
+
+  if(start % PGSIZE != 0 || oldlen <= 0 || oldlen % PGSIZE != 0 || newlen <= 0 ||
+     newlen % PGSIZE != 0 || (flags & ~MREMAP_MAYMOVE))
+    return ((void*)(char*) -1);
+
+  v = vmalookup(p, start);
+  if(v == 0 || (v->flags & MAP_EXECUTABLE) || end > (uint64)v->addrBegin + v->length)
+    return ((void*)(char*) -1);
+  if(newlen == oldlen)
+    return old;
+  if(newlen < oldlen)
+    return munmap((void*)(start + newlen), oldlen - newlen) == 0 ? old : ((void*)(char*) -1);
+
+  // El rango pasa a ser una VMA entera, que es lo que crece o se mueve
+  if((v = vmaclip(p, start, end)) == 0)
+    return ((void*)(char*) -1);
+
+  // Se crece en el sitio si entre el final y la VMA siguiente (o el trapframe) cabe lo que falta,
+  // y si no se busca un hueco para todo el mapeo, como en mmap. La pila y el heap no son VMAs:
+  // un mapeo por debajo del heap no crece en el sitio, que se los comería (vmaplace tampoco
+  // pone nada por debajo de p->sz)
+  next = vmanext(p, v);
+  if(start >= PGROUNDUP(p->sz) && start + newlen <= TRAPFRAME &&
+     (next == 0 || (uint64)next->addrBegin >= start + newlen))
+    nstart = start;
+  else if(!(flags & MREMAP_MAYMOVE) || (nstart = vmaplace(p, newlen)) == 0)
+    return ((void*)(char*) -1);
+
+  // Un mapeo anónimo compartido tiene todas sus páginas reservadas (ver mmap), también las nuevas.
+  // Se reservan antes de mover nada, para poder echarse atrás si no hay memoria
+  if(!v->mappedFile && (v->flags & MAP_SHARED)){
+    int perm = vmaperm(v);
+    for(a = nstart + oldlen; a < nstart + newlen; a += PGSIZE){
+      char *mem = kalloc();
+      if(mem == 0 || mappages(p->pagetable, a, PGSIZE, (uint64)mem, perm) != 0){
+        if(mem)
+          kfree(mem);
+        if(a > nstart + oldlen)
+          uvmunmap(p->pagetable, nstart + oldlen, (a - nstart - oldlen) / PGSIZE, 1);
+        return ((void*)(char*) -1);
+      }
+      memset(mem, 0, PGSIZE);
     }
-    v->length = v->length - PGSIZE;
   }
 
-  // #3. Liberar fichero si se borra mapeo entero
-  // Limpiamos los valores para evitar accesos malintencionados.
-  if(v->length == 0){
-    v->used = 0;
-    v->addrBegin = 0;
-    v->prot = 0;
-    v->flags = 0;
-    fileclose(v->mappedFile);
-    v->mappedFile = 0;
+  if(nstart != start && mremapmove(p, start, nstart, oldlen) < 0){
+    if(!v->mappedFile && (v->flags & MAP_SHARED))
+      uvmunmap(p->pagetable, nstart + oldlen, (newlen - oldlen) / PGSIZE, 1);
+    return ((void*)(char*) -1);
+  }
+
+  // La VMA se saca del árbol mientras cambian sus direcciones
+  vmaremove(p, v);
+  v->addrBegin = (void*)nstart;
+  v->length = newlen;
+  vmainsert(p, v);
+  if(DEBUG) printf("DEBUG: mremap: pid %d, %p (%d bytes) -> %p (%d bytes)\n", p->pid, old, oldlen, v->addrBegin, newlen);
+  return v->addrBegin;
+}
+
+// Escribe (MS_SYNC) o deja marcadas en la caché de páginas (MS_ASYNC) las páginas modificadas de
+// los mapeos compartidos de fichero en [addr, addr+length). Todo el rango tiene que estar mapeado.
+int
+msync(void *addr, int length, int flags){
+  struct proc* p = myproc();
+  struct VMA *v;
+  uint64 start = (uint64)addr;
+  uint64 end = PGROUNDUP(start + length);
+
+  if(length < 0 || start % PGSIZE != 0)
+    return -1;
+  if((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) || ((flags & MS_ASYNC) && (flags & MS_SYNC)))
+    return -1;
+  if(!vmamapped(p, start, end))
+    return -1;
+
+  for(v = vmafind(p, start); v && (uint64)v->addrBegin < end; v = vmanext(p, v)){
+    if(!(v->flags & MAP_SHARED) || v->mappedFile == 0)
+      continue;
+    uint64 s = start > (uint64)v->addrBegin ? start : (uint64)v->addrBegin;
+    uint64 e = end < (uint64)v->addrBegin + v->length ? end : (uint64)v->addrBegin + v->length;
+    mmapsync(p, v, s, e, flags);
+  }
+
+  return 0;
+}
+
+// Trae a la caché de páginas las páginas de fichero de [start, end) de v que aún no estén,
+// sin mapearlas: los fallos que vengan después las encontrarán ya en memoria.
+static void
+mmapwillneed(struct VMA *v, uint64 start, uint64 end)
+{
+  struct inode *ip = v->mappedFile->ip;
+  uint64 pa;
+
+  ilock(ip);
+  for(uint64 a = start; a < end; a += PGSIZE){
+    uint pgno = (v->offset + (a - (uint64)v->addrBegin)) / PGSIZE;
+    if(pgno * PGSIZE >= ip->size || (pa = pcacheget(ip, pgno)) == 0)
+      break;
+    putref((void*)pa);
+  }
+  iunlock(ip);
+}
+
+// Aplica a los mapeos de [addr, addr+length) el consejo advice sobre cómo se van a usar:
+// MADV_NORMAL, MADV_RANDOM y MADV_SEQUENTIAL cambian la lectura anticipada y el fault-around de
+// los fallos que vengan (partiendo las VMAs si el rango no las cubre enteras), MADV_WILLNEED
+// trae ya las páginas del fichero a la caché y MADV_DONTNEED suelta las páginas del proceso.
+// MADV_MERGEABLE y MADV_UNMERGEABLE dejan o no que ksmd comparta sus páginas (ver ksm.c).
+// Todo el rango tiene que estar mapeado.
+int
+madvise(void *addr, int length, int advice){
+  struct proc* p = myproc();
+  struct VMA *v;
+  uint64 start = (uint64)addr;
+  uint64 end = PGROUNDUP(start + length);
+
+  if(length < 0 || start % PGSIZE != 0 || advice < MADV_NORMAL || advice > MADV_UNMERGEABLE)
+    return -1;
+  if(length == 0)
+    return 0;
+  if(!vmamapped(p, start, end))
+    return -1;
+
+  if(advice == MADV_NORMAL || advice == MADV_RANDOM || advice == MADV_SEQUENTIAL){
+    if((v = vmaclip(p, start, end)) == 0)
+      return -1;
+    for(; v && (uint64)v->addrBegin < end; v = vmanext(p, v)){
+      v->advice = advice;
+      v->ra = 0;
+    }
+    return 0;
+  }
+
+  if(advice == MADV_MERGEABLE || advice == MADV_UNMERGEABLE){
+    if((v = vmaclip(p, start, end)) == 0)
+      return -1;
+    for(; v && (uint64)v->addrBegin < end; v = vmanext(p, v)){
+      if(advice == MADV_MERGEABLE)
+        v->flags |= MAP_MERGEABLE;
+      else
+        v->flags &= ~MAP_MERGEABLE;
+    }
+    return 0;
+  }
+
+  for(v = vmafind(p, start); v && (uint64)v->addrBegin < end; v = vmanext(p, v)){
+    uint64 s = start > (uint64)v->addrBegin ? start : (uint64)v->addrBegin;
+    uint64 e = end < (uint64)v->addrBegin + v->length ? end : (uint64)v->addrBegin + v->length;
+    if(advice == MADV_WILLNEED){
+      if(v->mappedFile)
+        mmapwillneed(v, s, e);
+    } else if(v->mappedFile || (v->flags & MAP_PRIVATE)){
+      // MADV_DONTNEED: lo que estaba en disco se volverá a leer y lo anónimo volverá a ser ceros.
+      // Un mapeo anónimo compartido no tiene de dónde volver a leer sus páginas, así que se queda.
+      munmappages(p, v, s, e, 1);
+    }
   }
 
   return 0;
 }
 
 /**
- * Copy p vma table used entries in np vma table
+ * Release every VMA of p without writing anything back, e.g. for a
+ * child whose fork failed half way through vmacopy.
+ */
+void
+vmadrop(struct proc *p){
+  struct VMA *v;
+
+  while((v = p->vmaroot) != 0){
+    munmappages(p, v, (uint64)v->addrBegin, (uint64)v->addrBegin + v->length, 0);
+    vmaremove(p, v);
+    if(v->mappedFile)
+      fileclose(v->mappedFile);
+    vmafree(v);
+  }
+}
+
+/**
+ * Copy every VMA of p into np, sharing the pages already mapped
  * 
  * @returns 0 on success, -1 on error.
  */
@@ -395,58 +1094,138 @@ vmacopy(struct proc *p, struct proc * np){
 
   if(!p || !np) return -1;
 
-  for(int i=0; i < MAX_VMAS; i++){
-    // Found used vma entry in p, dup in np
+  for(struct VMA *v = vmafirst(p); v; v = vmanext(p, v)){
+    // Dup every vma of p in np
     // Increment file reference, since another proc points to the file now
-    if(p->vmas[i].used == 1){
-      struct VMA *v = &p->vmas[i];
-      struct VMA *nv = &np->vmas[i];
-      nv->addrBegin = v->addrBegin;
-      nv->flags = v->flags;
-      nv->length = v->length;
-      nv->mappedFile = filedup(v->mappedFile);
-      nv->offset = v->offset;
-      nv->prot = v->prot;
-      nv->used = v->used;
-
-      // Mapear dirección de la PA del padre. Incrementar referencia de las páginas físicas empleadas
-      // De hecho hay que mapear también la PA en la PT porque uvmcopy solo mapea por abajo hasta sz,
-      // por lo que nunca llega a mapear las páginas. Igual a la larga esto es un problema si el heap
-      // se hiciera grande.
-      
-      // Por cada VMA, recorrer todas sus páginas y mapearlas en el nuevo proceso.
-      int len = v->length;
-      if(len % PGSIZE == 0) len -= 1;
-      uint64 start_pg = PGROUNDDOWN((uint64)v->addrBegin);
-      uint64 end_pg = PGROUNDDOWN((uint64)v->addrBegin + len);
-      uint64 pa = 0;
-
-      // Igual a lo que hace munmap en #2 
-      for(uint64 i = start_pg; i <= end_pg; i+=PGSIZE){
-        if((pa = walkaddr(p->pagetable, i)) != 0) {
-          // Los permisos del nuevo mapeo dependen del tipo de mapeo.
-          // Si es privado, no poner PTE_W y retirar PTE_W del mapeo original,
-          // forzando en ambos casos un COW.
-          // Si es compartido, PTE_W dependerá de si se permite escribir o no
-          int perm;
-          if(v->flags & MAP_PRIVATE){
-            perm = PTE_U | (v->prot & PROT_READ ? PTE_R : 0);
-            uvmunmap(p->pagetable, i, 1, 0);
-            mappages(p->pagetable, i, PGSIZE, pa, perm);
-          }
-          else{
-            perm = PTE_U | (v->prot & PROT_READ ? PTE_R : 0) | (v->prot & PROT_WRITE ? PTE_W : 0);
-          }
-          // Incrementar referencia a la PA
-          incref((void*)pa);
-          mappages(np->pagetable, i, PGSIZE, pa, perm);
-          if(DEBUG) printf("DEBUG: vmacopy: Valid PTE mapped from p to np, dir: %p \n", (void*)i);
-        } else {
-          if(DEBUG) printf("DEBUG: vmacopy: Lazy PTE mapped from p to np (nothing done), dir %p \n", (void*)i);
+    struct VMA *nv = vmaalloc();
+    if(nv == 0)
+      return -1;
+    nv->addrBegin = v->addrBegin;
+    nv->flags = v->flags;
+    nv->length = v->length;
+    nv->mappedFile = v->mappedFile ? filedup(v->mappedFile) : 0;
+    nv->offset = v->offset;
+    nv->prot = v->prot;
+    nv->nextpg = v->nextpg;
+    nv->ra = v->ra;
+    nv->advice = v->advice;
+    vmainsert(np, nv);
+
+    // Mapear dirección de la PA del padre. Incrementar referencia de las páginas físicas empleadas
+    // De hecho hay que mapear también la PA en la PT porque uvmcopy solo mapea por abajo hasta sz,
+    // por lo que nunca llega a mapear las páginas. Igual a la larga esto es un problema si el heap
+    // se hiciera grande.
+    
+    // Por cada VMA, recorrer todas sus páginas y mapearlas en el nuevo proceso.
+    int len = v->length;
+    if(len % PGSIZE == 0) len -= 1;
+    uint64 start_pg = PGROUNDDOWN((uint64)v->addrBegin);
+    uint64 end_pg = PGROUNDDOWN((uint64)v->addrBegin + len);
+    uint64 pa = 0;
+    pte_t *pte, *npte;
+    int error = 0;
+    struct ptcursor pc = { p->pagetable }, nc = { np->pagetable };
+
+    // Igual a lo que hace munmap en #2 
+    for(uint64 i = start_pg; i <= end_pg; i+=PGSIZE){
+      // Las páginas privadas que están en swap se quedan allí: el hijo comparte el hueco y cada
+      // uno leerá su propia copia cuando falle en ella
+      if((pte = walkcursor(&pc, i, 0)) != 0 && (*pte & PTE_SW)){
+        if((npte = walkcursor(&nc, i, 1)) == 0){
+          error = 1;
+          break;
+        }
+        swapdup(*pte);
+        *npte = *pte;
+        continue;
+      }
+      if(pte != 0 && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U)) {
+        pa = PTE2PA(*pte);
+        // Los permisos del nuevo mapeo dependen del tipo de mapeo.
+        // Si es privado, no poner PTE_W y retirar PTE_W del mapeo original,
+        // forzando en ambos casos un COW.
+        // Si es compartido, PTE_W dependerá de si se permite escribir o no
+        int perm;
+        if(v->flags & MAP_PRIVATE){
+          perm = vmaperm(v) & ~PTE_W;
+          *pte &= ~PTE_W;
+        }
+        else{
+          perm = vmaperm(v);
         }
+        // Incrementar referencia a la PA
+        incref((void*)pa);
+        if((npte = walkcursor(&nc, i, 1)) == 0 || rmapadd(npte, pa) < 0){
+          putref((void*)pa);
+          error = 1;
+          break;
+        }
+        *npte = PA2PTE(pa) | perm | PTE_V;
+        if(DEBUG) printf("DEBUG: vmacopy: Valid PTE mapped from p to np, dir: %p \n", (void*)i);
+      } else {
+        if(DEBUG) printf("DEBUG: vmacopy: Lazy PTE mapped from p to np (nothing done), dir %p \n", (void*)i);
       }
     }
+
+    // Al padre se le ha quitado PTE_W en el sitio: la TLB no puede seguir dejándole escribir en
+    // las páginas que ahora comparte con el hijo. Se invalida toda la VMA de una vez, también
+    // si se ha salido a medias por un error.
+    if(v->flags & MAP_PRIVATE)
+      tlbflush(p->pagetable, start_pg, (end_pg - start_pg) / PGSIZE + 1);
+    if(error)
+      return -1;
   }
 
   return 0;
-}
\ No newline at end of file
+}
+
+// Cuenta en m la página de la PTE pte, que está en la dirección a, dentro de la VMA v si no es 0.
+// Una página es del fichero si es la de la caché de páginas; si no, es anónima. Está compartida
+// si la mapea otra tabla de páginas más: las referencias de la caché y la propia de la página de
+// ceros no cuentan (ver kalloc.c).
+static void
+pagememstat(struct procmem *m, pte_t pte, struct VMA *v, uint64 a)
+{
+  uint64 pa;
+  int maps;
+
+  if(pte & PTE_SW){
+    m->swapped++;
+    return;
+  }
+  if((pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return;
+  pa = PTE2PA(pte);
+  maps = getref((void*)pa);
+  if(pa == (uint64)zeropage)
+    maps--;
+  m->rss++;
+  if(v && v->mappedFile && pcachehas(v->mappedFile->ip, (v->offset + (a - (uint64)v->addrBegin)) / PGSIZE, pa)){
+    m->file++;
+    maps--;
+  } else {
+    m->anon++;
+  }
+  if(maps > 1)
+    m->shared++;
+}
+
+// Cuenta en m la memoria de p: la pila y el heap, las páginas de cada VMA y las de la tabla de
+// páginas. Quien llama tiene p->lock y se asegura de que p no está cambiando su tabla de páginas
+// ni sus VMAs (ver memstat()).
+void
+procmemstat(struct proc *p, struct procmem *m)
+{
+  struct ptcursor c = { p->pagetable };
+  pte_t *pte;
+  uint64 a;
+
+  for(a = p->stackbot; a < p->sz; a += PGSIZE)
+    if((pte = walkcursor(&c, a, 0)) != 0)
+      pagememstat(m, *pte, 0, a);
+  for(struct VMA *v = vmafirst(p); v; v = vmanext(p, v))
+    for(a = (uint64)v->addrBegin; a < (uint64)v->addrBegin + v->length; a += PGSIZE)
+      if((pte = walkcursor(&c, a, 0)) != 0)
+        pagememstat(m, *pte, v, a);
+  m->ptpages = uvmptpages(p->pagetable);
+}
@@ -30,6 +30,7 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  char image;        // maps a program image (see fileimage())
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -429,6 +429,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcachetrunc(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -464,14 +466,44 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read the blocks holding bytes [off, off+n) of ip into the
+// buffer cache, MAXPREFETCH blocks per batch of disk requests,
+// so that a following readi() finds them there.
+// Caller must hold ip->lock.
+void
+iprefetch(struct inode *ip, uint off, uint n)
+{
+  uint bn, addr[MAXPREFETCH];
+  int m = 0;
+
+  if(off >= ip->size || off + n < off)
+    return;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(bn = off/BSIZE; bn*BSIZE < off + n; bn++){
+    if((addr[m] = bmap(ip, bn)) == 0)
+      break;
+    if(++m == MAXPREFETCH){
+      bprefetch(ip->dev, addr, m);
+      m = 0;
+    }
+  }
+  if(m > 0)
+    bprefetch(ip->dev, addr, m);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// Pages present in the page cache are copied from there,
+// since a shared mapping may have modified them.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
+  uint64 pa;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -480,6 +512,16 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((pa = pcachelookup(ip, off/PGSIZE)) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      if(either_copyout(user_dst, dst, (char*)pa + (off % PGSIZE), m) == -1) {
+        putref((void*)pa);
+        tot = -1;
+        break;
+      }
+      putref((void*)pa);
+      continue;
+    }
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
@@ -502,6 +544,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
 // there was an error of some kind.
+// A cached copy of the page is updated too (write-through),
+// unless a program image maps it (see pcachewrite()).
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
@@ -523,6 +567,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pcachewrite(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -1,13 +1,21 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// On a NUMA machine (see dtb.c) each node's free pages are kept on
+// a list of their own. kalloc() takes a page from the node of the
+// hart it runs on, or from the node the process asked for with
+// mempolicy(), and when that node has none left, from the others,
+// nearest first.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
+#include "kalloc.h"
 
 #define MAXPAGES (PHYSTOP / PGSIZE)
 
@@ -21,22 +29,59 @@ extern char end[]; // first address after kernel.
 struct run {
   struct run *next;
   uint ref; // reference count
+  uchar node; // NUMA node of the page
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist[MAXNODES]; // free pages of each NUMA node
   // DEP: For COW fork, we can't store the run in the 
   //      physical page, because we need space for the ref
   //      count.  Move to the kmem struct.
   struct run runs[MAXPAGES];
+  int npages;   // pages the allocator manages
+  int nfree;    // of those, on the free lists
+  int nodepages[MAXNODES];
+  int nodefree[MAXNODES];
+  int remote;   // pages taken from another node than the one wanted
+  int order[MAXNODES][MAXNODES]; // nodes to take pages from, for each node
+  int hartnode[NCPU];
 } kmem;
 
+// A page of zeros that read faults on untouched anonymous memory
+// map read-only (see mmapfault()), so reading memory before writing
+// it costs no page. It keeps a reference of its own and is never
+// freed; a write to it is copy-on-write, as to any shared page.
+void *zeropage;
+
 void
 kinit()
 {
+  int i, j, k, t;
+
   initlock(&kmem.lock, "kmem");
+
+  // Each node takes pages from itself first, then from the
+  // others in order of distance.
+  for(i = 0; i < numa_count; i++){
+    kmem.order[i][0] = i;
+    for(j = 1, k = 0; k < numa_count; k++)
+      if(k != i)
+        kmem.order[i][j++] = k;
+    for(j = 2; j < numa_count; j++){
+      for(k = j; k > 1 && numa_distance[i][kmem.order[i][k]] < numa_distance[i][kmem.order[i][k-1]]; k--){
+        t = kmem.order[i][k];
+        kmem.order[i][k] = kmem.order[i][k-1];
+        kmem.order[i][k-1] = t;
+      }
+    }
+  }
+  for(i = 0; i < NCPU; i++)
+    kmem.hartnode[i] = numa_node_of_hart(i);
+
   _freerange(end, (void*)PHYSTOP);
+  zeropage = kalloc();
+  memset(zeropage, 0, PGSIZE);
 }
 
 void
@@ -70,10 +115,15 @@ _kfree(void *pa)
   memset(pa, 1, PGSIZE);
 
   r = &kmem.runs[(uint64)pa / PGSIZE];
+  r->node = numa_node_of_addr((uint64)pa);
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  r->next = kmem.freelist[r->node];
+  kmem.freelist[r->node] = r;
+  kmem.npages++;
+  kmem.nfree++;
+  kmem.nodepages[r->node]++;
+  kmem.nodefree[r->node]++;
   release(&kmem.lock);
 }
 
@@ -90,6 +140,10 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // no PTE may still map a page that is freed.
+  if(RMAPDEBUG && rmapcount((uint64)pa) != 0)
+    panic("kfree: mapped");
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
@@ -104,11 +158,99 @@ kfree(void *pa)
   }
   
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  r->next = kmem.freelist[r->node];
+  kmem.freelist[r->node] = r;
+  kmem.nfree++;
+  kmem.nodefree[r->node]++;
   release(&kmem.lock);
 }
 
+// Drop a reference to page pa, as putref() does, but leave the
+// page in batch b instead of freeing it at once. The references
+// are dropped, and the pages freed, when freebatch() is called
+// or b is full.
+void
+putbatch(struct pagebatch *b, void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("putbatch");
+
+  b->pa[b->n++] = (uint64)pa;
+  if(b->n == FREEBATCH)
+    freebatch(b);
+}
+
+// Drop the references of the pages in batch b, and free those
+// that had no other, onto the free lists of their nodes all at
+// once. A page may be in b more than once.
+void
+freebatch(struct pagebatch *b)
+{
+  struct run *r, *head[MAXNODES], *tail[MAXNODES];
+  int cnt[MAXNODES];
+  int i, k = 0;
+
+  if(b->n == 0)
+    return;
+
+  // the pages that lose their last reference are ours alone now.
+  acquire(&kmem.lock);
+  for(i = 0; i < b->n; i++){
+    r = &kmem.runs[b->pa[i] / PGSIZE];
+    if(r->ref == 0)
+      panic("freebatch: ref");
+    if(r->ref > 1)
+      r->ref--;
+    else
+      b->pa[k++] = b->pa[i];
+  }
+  release(&kmem.lock);
+
+  for(i = 0; i < MAXNODES; i++){
+    head[i] = 0;
+    cnt[i] = 0;
+  }
+  for(i = 0; i < k; i++){
+    if(RMAPDEBUG && rmapcount(b->pa[i]) != 0)
+      panic("freebatch: mapped");
+    // Fill with junk to catch dangling refs.
+    memset((void*)b->pa[i], 1, PGSIZE);
+    r = &kmem.runs[b->pa[i] / PGSIZE];
+    if(head[r->node] == 0)
+      tail[r->node] = r;
+    r->next = head[r->node];
+    head[r->node] = r;
+    cnt[r->node]++;
+  }
+
+  acquire(&kmem.lock);
+  for(i = 0; i < MAXNODES; i++){
+    if(head[i] == 0)
+      continue;
+    tail[i]->next = kmem.freelist[i];
+    kmem.freelist[i] = head[i];
+    kmem.nfree += cnt[i];
+    kmem.nodefree[i] += cnt[i];
+  }
+  release(&kmem.lock);
+  b->n = 0;
+}
+
+// The NUMA node to allocate from: the one the current process
+// chose with mempolicy(), or else the one of this hart.
+static int
+allocnode(void)
+{
+  struct proc *p;
+  int node;
+
+  push_off();
+  p = mycpu()->proc;
+  node = p && p->memnode >= 0 ? p->memnode : kmem.hartnode[cpuid()];
+  pop_off();
+  return node;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
@@ -116,14 +258,29 @@ void *
 kalloc(void)
 {
   struct run *r;
-
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r){
-    r->ref = 1;
-    kmem.freelist = r->next;
+  int want = allocnode(), i, node;
+
+  for(;;){
+    acquire(&kmem.lock);
+    for(i = 0; i < numa_count; i++){
+      node = kmem.order[want][i];
+      if((r = kmem.freelist[node]) != 0){
+        r->ref = 1;
+        kmem.freelist[node] = r->next;
+        kmem.nfree--;
+        kmem.nodefree[node]--;
+        if(node != want)
+          kmem.remote++;
+        break;
+      }
+    }
+    release(&kmem.lock);
+
+    // Out of pages: take some back (see reclaim.c)
+    // and try again.
+    if(r || reclaim(SWAPBATCH) == 0)
+      break;
   }
-  release(&kmem.lock);
 
   if(r){
     memset((char*)((r - kmem.runs) * PGSIZE), 5, PGSIZE); // fill with junk
@@ -171,6 +328,30 @@ decref(void *pa)
   if(DEBUG) printf("DEBUG: decref: PA %p\n", pa);
 }
 
+/**
+ * Drop a reference to a page descriptor, freeing the page
+ * when it was the last one.
+ */
+void
+putref(void *pa)
+{
+  struct run *r;
+
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("putref");
+
+  acquire(&kmem.lock);
+  r = &kmem.runs[(uint64)pa / PGSIZE];
+  if(r->ref > 1){
+    r->ref--;
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
+
+  kfree(pa);
+}
+
 /**
  * Get reference count of a page descriptor.
  */
@@ -181,6 +362,61 @@ getref(void *pa)
   return r->ref;
 }
 
+/**
+ * Report the pages the allocator manages and how many are free.
+ */
+void
+kmemstat(int *total, int *free)
+{
+  acquire(&kmem.lock);
+  *total = kmem.npages;
+  *free = kmem.nfree;
+  release(&kmem.lock);
+}
+
+/**
+ * Report the NUMA nodes, the pages of each and how many are
+ * free, and the pages allocated from another node than the
+ * one wanted so far.
+ */
+void
+numastat(int *nodes, int *pages, int *free, int *remote)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  *nodes = numa_count;
+  for(i = 0; i < MAXNODES; i++){
+    pages[i] = kmem.nodepages[i];
+    free[i] = kmem.nodefree[i];
+  }
+  *remote = kmem.remote;
+  release(&kmem.lock);
+}
+
+/**
+ * Make the current process allocate its pages from NUMA node
+ * node, or from the node of the hart it runs on if node is -1.
+ * Returns -1 if there is no such node.
+ */
+int
+mempolicy(int node)
+{
+  if(node < -1 || node >= numa_count)
+    return -1;
+  myproc()->memnode = node;
+  return 0;
+}
+
+/**
+ * Number of mappings of the zero page.
+ */
+int
+zeromaps(void)
+{
+  return getref(zeropage) - 1;
+}
+
 /**
  * Print reference count of a page descriptor.
  */
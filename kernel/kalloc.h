@@ -0,0 +1,16 @@
+#ifndef _KALLOC_H_
+#define _KALLOC_H_
+
+#include "param.h"
+
+// Pages whose references are being dropped together, e.g. all
+// those of a range being unmapped: putbatch() collects them and
+// freebatch() frees the ones that were the last reference with a
+// single acquisition of the allocator's lock (see kalloc.c).
+// Lives on the stack of the function that unmaps.
+struct pagebatch {
+  int n;
+  uint64 pa[FREEBATCH];
+};
+
+#endif // _KALLOC_H_
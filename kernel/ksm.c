@@ -0,0 +1,275 @@
+// Same-page merging.
+//
+// Processes often hold anonymous pages with the same contents:
+// zeroed buffers, tables that every worker builds alike. The merge
+// thread (ksmd) finds them and makes them share one read-only page,
+// which the copy-on-write fault (see mmapfault()) copies again for
+// whoever writes to it, as it does after fork().
+//
+// It only looks at the private mappings a process has marked with
+// madvise(MADV_MERGEABLE), and of those at the pages that a single
+// PTE maps. Every few ticks it moves a clock hand over them, like
+// swap does and over the same processes, hashing a limited number
+// of pages per pass: those two numbers bound the CPU time it takes,
+// and ksmctl() sets them. A page that is
+//  - all zeros is mapped to the shared zero page (see kalloc.c);
+//  - the same as a stable page, one already shared this way, is
+//    mapped to that page;
+//  - neither, but has the hash of a page seen before in this lap of
+//    the hand, becomes a stable page itself, so that the page seen
+//    before is merged into it when the hand gets there again.
+//
+// stable[] finds stable pages by hash, and holds a reference to each:
+// a stable page never goes back to reference count 1, so the fault
+// path always copies it before letting anyone write. Stable pages
+// that nobody maps anymore are freed once per lap.
+//
+// Only ksmd uses the hand and seen[]; ksm.lock protects stable[],
+// the counters and the budget.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+extern struct proc proc[NPROC];
+
+struct ksmslot {
+  uint hash;
+  uint64 pa;             // stable page, 0 if none
+};
+
+struct ksmseen {
+  uint hash;
+  uint lap;              // lap of the hand it was seen in
+};
+
+struct {
+  struct spinlock lock;
+  struct ksmslot stable[KSMSLOTS];
+  struct ksmseen seen[KSMSLOTS];
+  uint zerohash;         // hash of a page of zeros
+  int pages;             // pages to hash per pass, 0 to stop
+  int ticks;             // ticks between passes
+  int hand;              // process
+  uint64 handva;         // and address in it
+  uint lap;
+  int scanned;           // pages hashed so far
+  int merged;            // PTEs moved to a shared page so far
+} ksm;
+
+static void ksmd(void);
+
+// Hash the contents of page pa.
+static uint
+pagehash(uint64 pa)
+{
+  uint64 *w = (uint64*)pa, h = 14695981039346656037UL;
+  int i;
+
+  for(i = 0; i < PGSIZE/sizeof(uint64); i++)
+    h = (h ^ w[i]) * 1099511628211UL;
+  return h ^ (h >> 32);
+}
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+  ksm.zerohash = pagehash((uint64)zeropage);
+  ksm.pages = KSMPAGES;
+  ksm.ticks = KSMTICKS;
+  kthread("ksmd", ksmd);
+}
+
+// Map the page of pte, pa, to page to instead, read-only.
+// Returns 1 if it did, 0 if out of memory.
+static int
+ksmmerge(pte_t *pte, uint64 pa, uint64 to)
+{
+  if(rmapadd(pte, to) < 0)
+    return 0;
+  incref((void*)to);
+  rmapdel(pte, pa);
+  *pte = PA2PTE(to) | (PTE_FLAGS(*pte) & ~(PTE_W|PTE_D));
+  putref((void*)pa);
+  return 1;
+}
+
+// Look for a page with the same contents as pa, which pte maps,
+// and merge the two. Returns whether *pte changed.
+static int
+ksmpage(pte_t *pte, uint64 pa)
+{
+  uint h = pagehash(pa);
+  struct ksmslot *s = &ksm.stable[h % KSMSLOTS];
+  struct ksmseen *seen = &ksm.seen[h % KSMSLOTS];
+  int r = 0;
+
+  if(h == ksm.zerohash && memcmp((void*)pa, zeropage, PGSIZE) == 0)
+    return ksmmerge(pte, pa, (uint64)zeropage);
+
+  acquire(&ksm.lock);
+  if(s->pa && s->hash == h && memcmp((void*)pa, (void*)s->pa, PGSIZE) == 0){
+    r = ksmmerge(pte, pa, s->pa);
+  } else if(seen->hash == h && seen->lap == ksm.lap && (s->pa == 0 || getref((void*)s->pa) == 1)){
+    // the stable reference keeps pa shared from now on.
+    if(s->pa)
+      putref((void*)s->pa);
+    incref((void*)pa);
+    s->pa = pa;
+    s->hash = h;
+    *pte &= ~PTE_W;
+    r = 1;
+  } else {
+    seen->hash = h;
+    seen->lap = ksm.lap;
+  }
+  release(&ksm.lock);
+  return r;
+}
+
+// Move the hand over the mergeable pages of p, from *va up to the end
+// of the address space or until n pages are hashed. Returns the number
+// hashed, adds those merged to *merged, and leaves *va where the hand
+// stopped. Caller must hold p->lock.
+static int
+ksmscan(struct proc *p, uint64 *va, int n, int *merged)
+{
+  struct VMA *v;
+  struct ptcursor c = { p->pagetable };
+  pte_t *pte;
+  uint64 a = *va, start, pa;
+  int k = 0;
+
+  for(v = vmafind(p, a); v; v = vmanext(p, v)){
+    if((v->flags & (MAP_PRIVATE|MAP_MERGEABLE)) != (MAP_PRIVATE|MAP_MERGEABLE))
+      continue;
+    start = (uint64)v->addrBegin;
+    for(a = a > start ? a : start; a < start + v->length; a += PGSIZE){
+      if(k == n){
+        *va = a;
+        return k;
+      }
+      if((pte = walkcursor(&c, a, 0)) == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+        continue;
+      pa = PTE2PA(*pte);
+      if(getref((void*)pa) != 1)
+        continue;
+      k++;
+      if(ksmpage(pte, pa)){
+        // p flushes the old PTE when it next returns to user space.
+        p->tlbstale = 1;
+        if(PTE2PA(*pte) != pa)
+          (*merged)++;
+      }
+    }
+  }
+  *va = MAXVA;
+  return k;
+}
+
+// Free the stable pages that only stable[] holds.
+static void
+ksmgc(void)
+{
+  struct ksmslot *s;
+
+  acquire(&ksm.lock);
+  for(s = ksm.stable; s < ksm.stable+KSMSLOTS; s++){
+    if(s->pa && getref((void*)s->pa) == 1){
+      putref((void*)s->pa);
+      s->pa = 0;
+    }
+  }
+  release(&ksm.lock);
+}
+
+// The merge thread: a pass of the hand every ksm.ticks ticks,
+// hashing ksm.pages pages at most.
+static void
+ksmd(void)
+{
+  struct proc *p;
+  int n, t, k, merged, visits;
+  uint t0;
+
+  for(;;){
+    acquire(&ksm.lock);
+    n = ksm.pages;
+    t = ksm.ticks;
+    release(&ksm.lock);
+
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < (uint)t)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    k = merged = visits = 0;
+    while(k < n && visits <= NPROC){
+      p = &proc[ksm.hand];
+      acquire(&p->lock);
+      if(swappable(p))
+        k += ksmscan(p, &ksm.handva, n - k, &merged);
+      else
+        ksm.handva = MAXVA;
+      release(&p->lock);
+
+      if(ksm.handva >= MAXVA){
+        ksm.handva = 0;
+        visits++;
+        if(++ksm.hand == NPROC){
+          ksm.hand = 0;
+          ksm.lap++;
+          ksmgc();
+        }
+      }
+    }
+
+    acquire(&ksm.lock);
+    ksm.scanned += k;
+    ksm.merged += merged;
+    release(&ksm.lock);
+  }
+}
+
+// Set how many pages the merge thread hashes per pass (0 stops it),
+// and how many ticks apart, interval, the passes are.
+int
+ksmctl(int pages, int interval)
+{
+  if(pages < 0 || interval < 1)
+    return -1;
+  acquire(&ksm.lock);
+  ksm.pages = pages;
+  ksm.ticks = interval;
+  release(&ksm.lock);
+  return 0;
+}
+
+// Report the pages hashed and merged so far, the stable pages, and
+// how many pages merging saves now: those the PTEs that share a
+// stable page would take if each had its own.
+void
+ksmstat(int *scanned, int *merged, int *stable, int *saved)
+{
+  struct ksmslot *s;
+  int r;
+
+  acquire(&ksm.lock);
+  *scanned = ksm.scanned;
+  *merged = ksm.merged;
+  *stable = *saved = 0;
+  for(s = ksm.stable; s < ksm.stable+KSMSLOTS; s++){
+    if(s->pa){
+      (*stable)++;
+      if((r = getref((void*)s->pa)) > 2)
+        *saved += r - 2;
+    }
+  }
+  release(&ksm.lock);
+}
@@ -22,15 +22,22 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    vmainit();       // VMA descriptors
+    rmapinit();      // reverse map
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    pcacheinit();    // file page cache
     iinit();         // inode table
     fileinit();      // file table
-    virtio_disk_init(); // emulated hard disk
+    virtio_disk_init(); // emulated hard disks
+    swapinit();      // swap area
     userinit();      // first user process
+    reclaiminit();   // reclaim thread
+    ksminit();       // same-page merging thread
+    ptreapinit();    // page-table reaper thread
     __sync_synchronize();
     started = 1;
   } else {
@@ -8,9 +8,12 @@
 extern uint64 UART0;
 extern uint64 UART0_IRQ;
 
-// virtio mmio interface
+// virtio mmio interface: the file system disk,
+// and the swap disk (see virtio_disk.c).
 extern uint64 VIRTIO0;
 extern uint64 VIRTIO0_IRQ;
+extern uint64 VIRTIO1;
+extern uint64 VIRTIO1_IRQ;
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 extern uint64 PLIC;
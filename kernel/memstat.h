@@ -0,0 +1,29 @@
+#ifndef _MEMSTAT_H_
+#define _MEMSTAT_H_
+
+#include "param.h"
+
+// Physical memory used by one process, in pages.
+struct procmem {
+  int pid;            // 0 if the slot of the process table is unused
+  char name[16];
+  int known;          // 0 if the process was busy in the kernel and could not be looked at
+  int rss;            // resident user pages
+  int anon;           // of those, anonymous: heap, stack, private copies
+  int file;           // of those, pages of the page cache
+  int shared;         // of those, mapped by some other page table too (COW, shared mappings, zero page)
+  int swapped;        // pages in swap
+  int ptpages;        // page-table pages
+};
+
+// What memstat() reports: every process, and the whole system.
+struct memstat {
+  struct procmem proc[NPROC];
+  int total;          // pages the allocator manages
+  int free;           // pages free
+  int cached;         // pages in the page cache
+  int rmaps;          // entries of the reverse map, one per mapped user PTE
+  int rmapbytes;      // memory the reverse map takes, in bytes
+};
+
+#endif // _MEMSTAT_H_
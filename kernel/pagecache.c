@@ -0,0 +1,468 @@
+// Page cache.
+//
+// The page cache holds whole pages of regular file contents,
+// keyed by (device, inode number, page index within the file).
+// Every mmap page fault goes through it, so processes mapping
+// the same file share the same physical pages, and a file that
+// is mapped again is served from memory instead of the disk.
+//
+// readi() copies out of a cached page when there is one, and
+// writei() updates the cached page as well as the disk blocks
+// (write-through), so read()/write() and mmap stay coherent.
+//
+// Interface:
+// * pcacheget() returns the page for a file offset, reading it
+//   from disk on a miss.
+// * pcachelookup() returns the page only if it is already cached.
+// * pcachefill() caches a run of pages, reading the blocks of the
+//   missing ones from disk in batches (see bprefetch()).
+// * Both return the page with an extra reference (see kalloc.c)
+//   that the caller hands to a page table or drops with putref().
+// * pcachetrunc() forgets every page of a file being truncated.
+// * pcachereclaim() frees the pages nobody maps when kalloc()
+//   runs out of memory.
+// * pcachedirty() and pcacheclean() keep the dirty mark that
+//   msync(MS_ASYNC) moves from a page table into the cache, so
+//   that a later msync(MS_SYNC) or munmap() writes the page.
+//   A dirty page is never recycled, and pcacheisclean() tells
+//   reclaim not to unmap it.
+// * pcacheexec() marks a page that a program image maps, i.e.
+//   code or data shared by every process running the program.
+//   pcachewrite() forgets such a page instead of updating it, so
+//   running programs keep the code they started with, and the
+//   next exec reads the new one. pcachestat() counts them.
+// * pcachehas() and pcachepages() tell memstat() which mapped
+//   pages are the cache's, and how many pages it holds.
+//
+// There are NPCACHE slots at first. When every one holds a page
+// that is mapped or dirty, the cache grows by a page of slots
+// rather than leave the new page uncached: processes sharing a
+// mapping of the file must all map the cache's page, or they
+// would not see each other's writes, nor write()'s. The slots
+// stay; their pages go back like any others.
+//
+// The caller must hold ip->lock, which serializes filling and
+// dropping the pages of one file. pcache.lock protects the
+// hash chains and the LRU list. The cache itself holds one
+// reference to each page; a page whose only reference is the
+// cache's is not mapped anywhere and can be recycled.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCBUCKET 61
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint pgno;             // page index within the file
+  uint64 pa;             // cached physical page, 0 if slot is free
+  int dirty;             // modified through a mapping, not yet on disk
+  int exec;              // mapped by a program image (see exec.c)
+  struct pcpage *hnext;  // hash chain
+  struct pcpage *prev;   // LRU list
+  struct pcpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *bucket[NPCBUCKET];
+
+  // Linked list of all slots, through prev/next.
+  // head.next is most recently used, head.prev is least.
+  struct pcpage head;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  struct pcpage *pg;
+
+  initlock(&pcache.lock, "pcache");
+
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+}
+
+// Add a page of free slots, at the least-recently-used end
+// so that they are used first. Returns -1 if out of memory.
+// Caller must not hold pcache.lock (see kalloc()).
+static int
+pcgrow(void)
+{
+  struct pcpage *pg, *pgs;
+
+  if((pgs = (struct pcpage*)kalloc()) == 0)
+    return -1;
+  memset(pgs, 0, PGSIZE);
+
+  acquire(&pcache.lock);
+  for(pg = pgs; pg < pgs + PGSIZE/sizeof(*pg); pg++){
+    pg->prev = pcache.head.prev;
+    pg->next = &pcache.head;
+    pcache.head.prev->next = pg;
+    pcache.head.prev = pg;
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+static uint
+pchash(uint dev, uint inum, uint pgno)
+{
+  return (dev * 31 + inum * 17 + pgno) % NPCBUCKET;
+}
+
+// Move pg to the most-recently-used end of the list.
+// Caller must hold pcache.lock.
+static void
+pctouch(struct pcpage *pg)
+{
+  pg->next->prev = pg->prev;
+  pg->prev->next = pg->next;
+  pg->next = pcache.head.next;
+  pg->prev = &pcache.head;
+  pcache.head.next->prev = pg;
+  pcache.head.next = pg;
+}
+
+// Remove pg from its hash chain and drop the cache's reference
+// to its page. Caller must hold pcache.lock.
+static void
+pcunhash(struct pcpage *pg)
+{
+  struct pcpage **pp;
+
+  for(pp = &pcache.bucket[pchash(pg->dev, pg->inum, pg->pgno)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == pg){
+      *pp = pg->hnext;
+      break;
+    }
+  }
+  putref((void*)pg->pa);
+  pg->pa = 0;
+  pg->dirty = 0;
+  pg->exec = 0;
+  pg->hnext = 0;
+}
+
+// Find the slot caching page pgno of ip.
+// Caller must hold pcache.lock.
+static struct pcpage*
+pclookup(struct inode *ip, uint pgno)
+{
+  struct pcpage *pg;
+
+  for(pg = pcache.bucket[pchash(ip->dev, ip->inum, pgno)]; pg; pg = pg->hnext)
+    if(pg->dev == ip->dev && pg->inum == ip->inum && pg->pgno == pgno)
+      return pg;
+  return 0;
+}
+
+// Return the cached page holding page pgno of ip, with an extra
+// reference for the caller, or 0 if it is not cached.
+// Caller must hold ip->lock.
+uint64
+pcachelookup(struct inode *ip, uint pgno)
+{
+  struct pcpage *pg;
+  uint64 pa = 0;
+
+  acquire(&pcache.lock);
+  if((pg = pclookup(ip, pgno)) != 0){
+    pa = pg->pa;
+    incref((void*)pa);
+    pctouch(pg);
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Enter pa as page pgno of ip, recycling the least recently used
+// slot whose page is not mapped anywhere. If every slot is busy
+// the cache grows. Returns -1 if out of memory.
+// Caller must hold ip->lock.
+static int
+pcacheinsert(struct inode *ip, uint pgno, uint64 pa)
+{
+  struct pcpage *pg;
+  uint h;
+
+  for(;;){
+    acquire(&pcache.lock);
+    for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev){
+      if(pg->pa == 0 || (getref((void*)pg->pa) == 1 && !pg->dirty))
+        break;
+    }
+    if(pg != &pcache.head)
+      break;
+    release(&pcache.lock);
+    if(pcgrow() < 0)
+      return -1;
+  }
+  if(pg->pa)
+    pcunhash(pg);
+
+  pg->dev = ip->dev;
+  pg->inum = ip->inum;
+  pg->pgno = pgno;
+  pg->pa = pa;
+  incref((void*)pa);
+  h = pchash(ip->dev, ip->inum, pgno);
+  pg->hnext = pcache.bucket[h];
+  pcache.bucket[h] = pg;
+  pctouch(pg);
+  release(&pcache.lock);
+  return 0;
+}
+
+// Return the physical page holding page pgno of ip, with an
+// extra reference for the caller. Reads the page from disk on
+// a miss; bytes past the end of the file read as zero.
+// Returns 0 if out of memory.
+// Caller must hold ip->lock.
+uint64
+pcacheget(struct inode *ip, uint pgno)
+{
+  uint64 pa;
+
+  if((pa = pcachelookup(ip, pgno)) != 0)
+    return pa;
+
+  if((pa = (uint64)kalloc()) == 0)
+    return 0;
+  memset((void*)pa, 0, PGSIZE);
+  iprefetch(ip, pgno*PGSIZE, PGSIZE);
+  readi(ip, 0, pa, pgno*PGSIZE, PGSIZE);
+  if(pcacheinsert(ip, pgno, pa) < 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  return pa;
+}
+
+// Cache pages pgno .. pgno+n-1 of ip (those inside the file).
+// The blocks of the missing pages are read MAXPREFETCH at a time,
+// each batch just before the pages that use it, so they are still
+// in the buffer cache when pcacheget() copies them into the pages.
+// Stops early if out of memory.
+// Caller must hold ip->lock.
+void
+pcachefill(struct inode *ip, uint pgno, uint n)
+{
+  uint i, j, last, first = 0, run = 0;
+  uint64 pa;
+  int miss;
+
+  last = (ip->size + PGSIZE - 1) / PGSIZE;
+  if(pgno + n < last)
+    last = pgno + n;
+
+  for(i = pgno; i <= last; i++){
+    miss = 0;
+    if(i < last){
+      if((pa = pcachelookup(ip, i)) != 0)
+        putref((void*)pa);
+      else
+        miss = 1;
+    }
+    if(miss && run++ == 0)
+      first = i;
+    if(run > 0 && (!miss || run*(PGSIZE/BSIZE) >= MAXPREFETCH)){
+      iprefetch(ip, first*PGSIZE, run*PGSIZE);
+      for(j = first; j < first + run; j++){
+        if((pa = pcacheget(ip, j)) == 0)
+          return;
+        putref((void*)pa);
+      }
+      run = 0;
+    }
+  }
+}
+
+// Find the slot caching pa as page pgno of ip.
+// Caller must hold pcache.lock.
+static struct pcpage*
+pcfind(struct inode *ip, uint pgno, uint64 pa)
+{
+  struct pcpage *pg;
+
+  if((pg = pclookup(ip, pgno)) != 0 && pg->pa == pa)
+    return pg;
+  return 0;
+}
+
+// Mark pa, page pgno of ip, as modified. Returns 0 if pa is not
+// the cached copy of that page, and then the caller must keep
+// track of the modification itself.
+int
+pcachedirty(struct inode *ip, uint pgno, uint64 pa)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcfind(ip, pgno, pa)) != 0)
+    pg->dirty = 1;
+  release(&pcache.lock);
+  return pg != 0;
+}
+
+// Clear the dirty mark of pa, page pgno of ip, because the
+// caller is about to write it. Returns whether it was set.
+int
+pcacheclean(struct inode *ip, uint pgno, uint64 pa)
+{
+  struct pcpage *pg;
+  int dirty = 0;
+
+  acquire(&pcache.lock);
+  if((pg = pcfind(ip, pgno, pa)) != 0){
+    dirty = pg->dirty;
+    pg->dirty = 0;
+  }
+  release(&pcache.lock);
+  return dirty;
+}
+
+// Drop every cached page that is not mapped anywhere and not
+// dirty, giving its memory back. kalloc() calls this when it
+// runs out of pages, so caller must not hold pcache.lock.
+// Returns the number of pages freed.
+int
+pcachereclaim(void)
+{
+  struct pcpage *pg;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev){
+    if(pg->pa && getref((void*)pg->pa) == 1 && !pg->dirty){
+      pcunhash(pg);
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+// Mark pa, page pgno of ip, as mapped by a program image,
+// if it is the cached copy of that page.
+void
+pcacheexec(struct inode *ip, uint pgno, uint64 pa)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcfind(ip, pgno, pa)) != 0)
+    pg->exec = 1;
+  release(&pcache.lock);
+}
+
+// writei() is writing the n bytes at src to offset off of ip:
+// update the cached copy of their page, if there is one, or
+// forget it if a program image maps it.
+// Caller must hold ip->lock.
+void
+pcachewrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pclookup(ip, off/PGSIZE)) != 0){
+    if(pg->exec)
+      pcunhash(pg);
+    else
+      memmove((char*)pg->pa + off%PGSIZE, src, n);
+  }
+  release(&pcache.lock);
+}
+
+// Count the cached pages mapped by program images into *pages,
+// and how many mappings of them there are into *maps. Every
+// mapping past the first of a page is a page saved.
+void
+pcachestat(int *pages, int *maps)
+{
+  struct pcpage *pg;
+
+  *pages = *maps = 0;
+  acquire(&pcache.lock);
+  for(pg = pcache.head.next; pg != &pcache.head; pg = pg->next){
+    if(pg->pa && pg->exec && getref((void*)pg->pa) > 1){
+      (*pages)++;
+      *maps += getref((void*)pg->pa) - 1;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Return whether pa is the cached copy of page pgno of ip.
+int
+pcachehas(struct inode *ip, uint pgno, uint64 pa)
+{
+  int r;
+
+  acquire(&pcache.lock);
+  r = pcfind(ip, pgno, pa) != 0;
+  release(&pcache.lock);
+  return r;
+}
+
+// Return whether pa is the cached copy of page pgno of ip,
+// and it has no writes waiting in the cache.
+int
+pcacheisclean(struct inode *ip, uint pgno, uint64 pa)
+{
+  struct pcpage *pg;
+  int r;
+
+  acquire(&pcache.lock);
+  r = (pg = pcfind(ip, pgno, pa)) != 0 && !pg->dirty;
+  release(&pcache.lock);
+  return r;
+}
+
+// Return the number of pages in the cache.
+int
+pcachepages(void)
+{
+  struct pcpage *pg;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.head.next; pg != &pcache.head; pg = pg->next)
+    if(pg->pa)
+      n++;
+  release(&pcache.lock);
+  return n;
+}
+
+// Forget every cached page of ip, e.g. because it is being
+// truncated. Pages still mapped by some process stay alive
+// through the page tables' references.
+// Caller must hold ip->lock.
+void
+pcachetrunc(struct inode *ip)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.head.next; pg != &pcache.head; pg = pg->next){
+    if(pg->pa && pg->dev == ip->dev && pg->inum == ip->inum)
+      pcunhash(pg);
+  }
+  release(&pcache.lock);
+}
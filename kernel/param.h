@@ -2,6 +2,7 @@
 #define __PARAM_H__
 
 #define DEBUG         0  // enable debug messages    
+#define RMAPDEBUG     0  // check the reverse map on every change
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
@@ -9,14 +10,36 @@
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define SWAPDEV       2  // device number of the swap disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define MAXSEGS       8  // max loadable segments in a program
+#define MAXOPBLOCKS  18  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define FSSIZE       4000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define USERSTACKMAX 256   // max pages a user stack can grow to
 #define CLOCKTICKS   1000000    // clock ticks that pass until a clock interrupt happens
-#define MAX_VMAS     16    // maximum number of VMAs a process can have
+#define MAX_VMAS     65536 // maximum number of VMAs a process can have
+#define NPCACHE      256   // size of file page cache (pages)
+#define FAULTAROUND  16    // pages mapped around an mmap fault when already cached
+#define RECLAIMLOW   128   // free pages below which the reclaim thread wakes up
+#define RECLAIMHIGH  256   // free pages it stops at
+#define KSMSLOTS     256   // shared pages the merge thread can keep track of
+#define KSMPAGES     256   // pages it hashes per pass, by default
+#define KSMTICKS     10    // ticks between its passes, by default
+#define MINREADAHEAD 4     // initial readahead window of a sequential mapping (pages)
+#define MAXREADAHEAD 32    // maximum readahead window of a sequential mapping (pages)
+#define MAXPREFETCH  16    // max # of blocks read from disk in one batch
+#define NSWAP        16384 // size of the swap area (pages); swap.img in Makefile
+#define SWAPBATCH    16    // max # of pages evicted to swap in one batch
+#define PTCACHE      16    // zeroed page-table pages each hart keeps at hand
+#define FREEBATCH    32    // max # of pages freed with one acquisition of the allocator's lock
+#define NZSWAP       16384 // max # of pages in the compressed swap pool
+#define ZPOOLPAGES   2048  // max # of pages the compressed swap pool takes
+#define MAXNODES     4     // max # of NUMA nodes
+#define TIMEHZ       10000000 // rate of the time counter (timebase-frequency)
+#define TLBFLUSHMAX  32    // flush a whole address space rather than more pages than this
 
 #endif
\ No newline at end of file
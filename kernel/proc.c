@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "pstat.h"
+#include "memstat.h"
 #include "defs.h"
 #include "file.h"
 
@@ -134,6 +135,7 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->memnode = -1;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -169,9 +171,16 @@ freeproc(struct proc *p)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_freepagetable(p->pagetable, p->stackbot, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->stackbot = 0;
+  p->stacklimit = 0;
+  p->vmaroot = 0;
+  p->nvmas = 0;
+  p->asid = 0;
+  p->tlbstale = 0;
+  p->kfunc = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -199,7 +208,7 @@ proc_pagetable(struct proc *p)
   // to/from user space, so not PTE_U.
   if(mappages(pagetable, TRAMPOLINE, PGSIZE,
               (uint64)trampoline, PTE_R | PTE_X) < 0){
-    uvmfree(pagetable, 0);
+    uvmfree(pagetable, 0, 0);
     return 0;
   }
 
@@ -208,7 +217,7 @@ proc_pagetable(struct proc *p)
   if(mappages(pagetable, TRAPFRAME, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-    uvmfree(pagetable, 0);
+    uvmfree(pagetable, 0, 0);
     return 0;
   }
 
@@ -216,13 +225,15 @@ proc_pagetable(struct proc *p)
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to from start to sz.
+// The pages below start belong to VMAs, which
+// must already have been unmapped.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(pagetable_t pagetable, uint64 start, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
-  uvmfree(pagetable, sz);
+  uvmfree(pagetable, start, sz);
 }
 
 // a user program that calls exec("/init")
@@ -249,11 +260,15 @@ userinit(void)
 
   p->tickets = 10;
   p->clockticks = 0;
+  p->faults = 0;
+  p->wbpages = 0;
   
   // allocate one user page and copy initcode's instructions
   // and data into it.
   uvmfirst(p->pagetable, initcode, sizeof(initcode));
   p->sz = PGSIZE;
+  p->stackbot = 0;
+  p->stacklimit = 0;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -267,6 +282,41 @@ userinit(void)
   release(&p->lock);
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadstart.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfunc();
+  panic("kthread returned");
+}
+
+// Start a kernel thread that runs fn, which never returns.
+// It is a process with no user memory, which never returns to
+// user space: it runs in the kernel, sleeping when it has
+// nothing to do.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfunc = fn;
+  p->context.ra = (uint64)kthreadstart;
+  p->tickets = 10;
+  p->clockticks = 0;
+  p->faults = 0;
+  p->wbpages = 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -274,19 +324,45 @@ growproc(int n)
 {
   uint64 sz;
   struct proc *p = myproc();
+  struct VMA *v;
 
   sz = p->sz;
   if(n > 0){
+    // The heap must not grow into the mapping above it.
+    if((v = vmafind(p, sz)) != 0 && PGROUNDUP(sz + n) > (uint64)v->addrBegin)
+      return -1;
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
       return -1;
     }
   } else if(n < 0){
+    // Nor shrink into the stack region, which ends where
+    // the heap starts (see exec()).
+    if(sz + n < p->stacklimit + USERSTACKMAX*PGSIZE)
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
   return 0;
 }
 
+// If va is in the part of p's stack region that the stack has
+// not grown into yet, grow the stack down to va's page. Pages
+// are allocated all the way down, so that the stack and the heap
+// stay mapped without holes from p->stackbot to p->sz.
+// Returns 1 if it did, 0 if va is not there, -1 if out of memory.
+int
+growstack(struct proc *p, uint64 va)
+{
+  uint64 a = PGROUNDDOWN(va);
+
+  if(va < p->stacklimit || va >= p->stackbot)
+    return 0;
+  if(uvmalloc(p->pagetable, a, p->stackbot, PTE_W) == 0)
+    return -1;
+  p->stackbot = a;
+  return 1;
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
@@ -302,21 +378,34 @@ fork(void)
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // The program image is in VMAs, which vmacopy() shares below.
+  if(uvmcopy(p->pagetable, np->pagetable, p->stackbot, p->sz) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  np->stackbot = p->stackbot;
+  np->stacklimit = p->stacklimit;
 
   // Copy number of tickets
   np->tickets = p->tickets;
 
-  // Restart number of ticks
+  // and where it allocates memory from
+  np->memnode = p->memnode;
+
+  // Restart number of ticks and page faults
   np->clockticks = 0;
+  np->faults = 0;
+  np->wbpages = 0;
 
   // Copy parent VMAs to child.
-  vmacopy(p, np);
+  if(vmacopy(p, np) < 0){
+    vmadrop(np);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -383,11 +472,8 @@ exit(int status)
   }
 
   // Free all mapped VMAs
-  for(int i=0;i<MAX_VMAS;i++){
-    if(p->vmas[i].used){
-      munmap(p->vmas[i].addrBegin,p->vmas[i].length);
-    }
-  }
+  while(p->vmaroot)
+    munmap(p->vmaroot->addrBegin, p->vmaroot->length);
 
   begin_op();
   iput(p->cwd);
@@ -421,7 +507,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -438,15 +524,15 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = pp->xstate;
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
+          // copy the status out without holding the locks,
+          // since the copy may have to fault the page in.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&pp->lock);
@@ -763,6 +849,58 @@ getpinfo(uint64 pinfo){
     auxPinfo.tickets[i] = proc[i].tickets;
 
     auxPinfo.ticks[i] = proc[i].clockticks;
+
+    auxPinfo.faults[i] = proc[i].faults;
+
+    auxPinfo.wbpages[i] = proc[i].wbpages;
   }
+  pcachestat(&auxPinfo.imgpages, &auxPinfo.imgmaps);
+  swapstat(&auxPinfo.swapsize, &auxPinfo.swapused, &auxPinfo.swapouts, &auxPinfo.swapins);
+  zstat(&auxPinfo.zswapused, &auxPinfo.zswapbytes, &auxPinfo.zswappages, &auxPinfo.zswapouts);
+  zswapstat(&auxPinfo.zswapins, &auxPinfo.zswapinlat, &auxPinfo.swapinlat);
+  numastat(&auxPinfo.numanodes, auxPinfo.nodepages, auxPinfo.nodefree, &auxPinfo.remoteallocs);
+  ptstat(&auxPinfo.ptcached, &auxPinfo.pthits, &auxPinfo.ptmisses, &auxPinfo.ptreaped);
+  asidstat(&auxPinfo.asids, &auxPinfo.tlbflushes);
+  auxPinfo.zeromaps = zeromaps();
+  reclaimstat(&auxPinfo.reclaimed, &auxPinfo.bgreclaimed, &auxPinfo.filedrops);
+  ksmstat(&auxPinfo.ksmscanned, &auxPinfo.ksmmerged, &auxPinfo.ksmstable, &auxPinfo.ksmsaved);
   copyout(myproc()->pagetable,pinfo,(char*)&auxPinfo, sizeof(struct pstat));
-}
\ No newline at end of file
+}
+
+
+// Copy the memory use of every process, and of the whole system,
+// to the struct memstat at user address addr.
+// Returns 0, or -1 if addr is bad.
+int
+memstat(uint64 addr)
+{
+  struct proc *p;
+  struct procmem m;
+  int i, sys[5];
+
+  for(i = 0; i < NPROC; i++){
+    p = &proc[i];
+    memset(&m, 0, sizeof(m));
+    acquire(&p->lock);
+    if(p->state != UNUSED){
+      m.pid = p->pid;
+      safestrcpy(m.name, p->name, sizeof(m.name));
+      // like the swap clock hand (see swap.c), only look at page
+      // tables and VMAs that nobody is changing right now.
+      if(p->pagetable && (p == myproc() ||
+         ((p->state == SLEEPING || p->state == RUNNABLE || p->state == ZOMBIE) && !p->kpreempt))){
+        m.known = 1;
+        procmemstat(p, &m);
+      }
+    }
+    release(&p->lock);
+    if(copyout(myproc()->pagetable, addr + i*sizeof(m), (char*)&m, sizeof(m)) < 0)
+      return -1;
+  }
+
+  kmemstat(&sys[0], &sys[1]);
+  sys[2] = pcachepages();
+  rmapstat(&sys[3], &sys[4]);
+  return copyout(myproc()->pagetable, addr + __builtin_offsetof(struct memstat, total),
+                 (char*)sys, sizeof(sys));
+}
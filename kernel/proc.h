@@ -30,6 +30,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this hart's TLB is clean for (see vm.c)
 };
 
 extern struct cpu cpus[NCPU];
@@ -87,23 +88,53 @@ struct trapframe {
 
 // Information about a Virtual Memory Area
 struct VMA {
-    int used;               // 0 if unused, 1 if used
     void* addrBegin;       // Virtual address where this VMA begins (must be a multiple of PGSIZE)
     int length;          // Size of the VMA in bytes (must be a multiple of PGSIZE)
     int prot;               // Protection (read and/or write, or none)
     int flags;              // Sharing flags (private, shared)
     int offset;          // From what byte in the file we are mapping
-    struct file* mappedFile;   // The file that is being mapped
+    struct file* mappedFile;   // The file that is being mapped (0 if anonymous)
+    uint nextpg;            // File page where a sequential scan would fault next
+    uint ra;                // Current readahead window in pages (0 while access looks random)
+    int advice;             // Access pattern given by madvise (MADV_NORMAL by default)
+    struct VMA *left;       // Process's VMA tree, sorted by addrBegin (see vma.c)
+    struct VMA *right;
+    int height;
+    uint64 lo;              // Lowest address, highest end and largest hole
+    uint64 hi;              // between two VMAs in this subtree
+    uint64 gap;
 };
 
 // Protection bits for a VMA
 #define PROT_READ   1
 #define PROT_WRITE  (1 << 1)
 #define PROT_NONE   (1 << 2)
+#define PROT_EXEC   (1 << 3)
 
 // Sharing flags for a VMA
 #define MAP_PRIVATE 1
 #define MAP_SHARED  (1 << 1)
+#define MAP_ANONYMOUS (1 << 2)  // Not backed by a file: fd is ignored, pages start zeroed
+#define MAP_POPULATE  (1 << 3)  // Read and map every page now instead of on page faults
+#define MAP_EXECUTABLE (1 << 4) // Part of a program image; set by exec only
+#define MAP_MERGEABLE  (1 << 5) // Pages may be merged with identical ones (see ksm.c); set by madvise only
+
+// Flags for mremap
+#define MREMAP_MAYMOVE 1        // Move the mapping elsewhere if it can't grow where it is
+
+// Flags for msync
+#define MS_ASYNC      1         // Hand the dirty pages to the page cache and return
+#define MS_INVALIDATE (1 << 1)  // Accepted; the page cache keeps every mapping coherent
+#define MS_SYNC       (1 << 2)  // Write the dirty pages to disk before returning
+
+// Advice for madvise
+#define MADV_NORMAL     0  // Default readahead and fault-around
+#define MADV_RANDOM     1  // No readahead nor fault-around
+#define MADV_SEQUENTIAL 2  // Always the largest readahead window
+#define MADV_WILLNEED   3  // Read the file pages into the page cache now
+#define MADV_DONTNEED   4  // Drop the pages now; they are read again (or zeroed) on the next access
+#define MADV_MERGEABLE  5  // Let the merge thread share the private pages with identical ones
+#define MADV_UNMERGEABLE 6 // Stop merging them; pages already merged stay so until written
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
@@ -124,6 +155,8 @@ struct proc {
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  uint64 stackbot;             // Lowest page of the stack; stack and heap are mapped from here up to sz
+  uint64 stacklimit;           // Lowest address the stack may grow down to (see growstack())
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
@@ -137,8 +170,29 @@ struct proc {
   // Approximate number of clock ticks that this process has executed
   uint64 clockticks;
 
+  // Number of page faults taken on mapped memory
+  uint64 faults;
+
+  // Number of pages of shared mappings written back to disk
+  uint64 wbpages;
+
+  // Preempted in the middle of kernel code, so its pages can't be swapped out (see swap.c)
+  int kpreempt;
+
+  // NUMA node to allocate pages from (see mempolicy()); -1 for the node of the hart it runs on
+  int memnode;
+
+  // Function that a kernel thread runs (see kthread()); 0 for user processes
+  void (*kfunc)(void);
+
+  // Address-space ID of the user page table, and TLB state (see vm.c)
+  uint64 asid;                 // ASID in the low bits, its generation above; 0 if none
+  int tlbstale;                // User PTEs changed since this process's TLB entries were flushed
+  int tlbcpu;                  // Hart it last returned to user space on
+
   // VMAs of this proccess
-  struct VMA vmas[MAX_VMAS];
+  struct VMA *vmaroot;         // AVL tree sorted by address (see vma.c)
+  int nvmas;                   // Number of VMAs in the tree
 };
 
 #endif
\ No newline at end of file
@@ -8,6 +8,39 @@ struct pstat {
   int tickets[NPROC]; // the number of tickets this process has
   int pid[NPROC];     // the PID of each process
   int ticks[NPROC];   // the number of ticks each process has accumulated 
+  int faults[NPROC];  // the number of page faults each process has taken
+  int wbpages[NPROC]; // the number of mapped pages each process has written back
+  int imgpages;       // physical pages of program images shared from the page cache
+  int imgmaps;        // the number of times processes map those pages
+  int swapsize;       // pages in the swap area (0 without a swap disk)
+  int swapused;       // pages in swap right now
+  int swapouts;       // pages written to swap since boot
+  int swapins;        // pages read back from swap since boot
+  int zswapused;      // pages in the compressed swap pool right now
+  int zswapbytes;     // their compressed size, in bytes
+  int zswappages;     // physical pages the pool takes right now
+  int zswapouts;      // pages compressed into the pool since boot
+  int zswapins;       // pages decompressed from it since boot
+  int zswapinlat;     // average time to bring back a page from the pool (microseconds)
+  int swapinlat;      // and from the swap disk
+  int numanodes;      // NUMA nodes (1 if the device tree describes none)
+  int nodepages[MAXNODES]; // physical pages of each node
+  int nodefree[MAXNODES];  // of those, free right now
+  int remoteallocs;   // pages allocated from another node than the one wanted since boot
+  int ptcached;       // zeroed page-table pages the harts keep at hand right now
+  int pthits;         // page-table pages taken from there since boot
+  int ptmisses;       // and from the page allocator
+  int ptreaped;       // page tables the reaper has torn down since boot
+  int asids;          // hardware ASIDs for processes (0: the TLB is flushed on every return to user space)
+  int tlbflushes;     // TLB flushes on returns to user space since boot
+  int zeromaps;       // mappings of the shared zero page
+  int reclaimed;      // pages freed by reclaim since boot
+  int bgreclaimed;    // of those, by the reclaim thread in the background
+  int filedrops;      // clean file pages unmapped by reclaim since boot
+  int ksmscanned;     // pages the merge thread has hashed since boot
+  int ksmmerged;      // PTEs it has moved to a shared page since boot
+  int ksmstable;      // pages shared that way right now, the zero page aside
+  int ksmsaved;       // pages that sharing them saves right now
 };
 
 #endif // _PSTAT_H_
\ No newline at end of file
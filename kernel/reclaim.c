@@ -0,0 +1,194 @@
+// Memory reclaim.
+//
+// When kalloc() runs out of pages it calls reclaim() to take some
+// back, instead of failing at once. So does the reclaim thread, in
+// the background, whenever the free pages drop below RECLAIMLOW
+// (param.h), until they are back up to RECLAIMHIGH, so that most
+// allocations find a free page without having to wait.
+//
+// reclaim() takes memory back in this order, cheapest first:
+//  1. pages of the page cache that nobody maps (pcachereclaim()),
+//     and page-table pages: those of exited processes still
+//     waiting for the reaper, and the zeroed ones the harts keep
+//     at hand (ptcachedrain());
+//  2. clean pages of file mappings: their PTEs are cleared, and the
+//     next fault maps them again from the cache or reads the file.
+//     Once no PTE maps a page, step 1 frees it;
+//  3. anonymous pages, which go to swap: compressed into memory, or
+//     to the swap disk if there is one (see swap.c).
+//
+// Step 2 sweeps the file mappings of one process after another with
+// a clock hand, like swap does, and looks at the same processes. A
+// page accessed (PTE_A) since the hand last went by keeps its PTE.
+// Pages written through the mapping (PTE_D, or dirty in the page
+// cache after msync(MS_ASYNC)), private copies, and those of
+// program images, which must not change under a running program
+// (see pcacheexec()), are left alone.
+//
+// Steps 2 and 3 sleep, so callers holding a spinlock only get
+// step 1. lock makes the callers that can sleep take turns, and
+// protects the hand.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct sleeplock lock;
+  int hand;              // process
+  uint64 handva;         // and address in it
+  int freed;             // pages freed so far
+  int bgfreed;           // of those, by the reclaim thread
+  int dropped;           // PTEs of file pages cleared so far
+} rec;
+
+static void reclaimd(void);
+
+void
+reclaiminit(void)
+{
+  initsleeplock(&rec.lock, "reclaim");
+  kthread("reclaimd", reclaimd);
+}
+
+// Move the hand over the file mappings of p, from *va up to the
+// end of the address space or until n PTEs are cleared. Returns
+// the number cleared and leaves *va where the hand stopped.
+// Caller must hold p->lock.
+static int
+dropscan(struct proc *p, uint64 *va, int n)
+{
+  struct VMA *v;
+  struct ptcursor c = { p->pagetable };
+  pte_t *pte;
+  uint64 a = *va, start, pa;
+  int k = 0;
+
+  for(v = vmafind(p, a); v; v = vmanext(p, v)){
+    if(v->mappedFile == 0 || (v->flags & MAP_EXECUTABLE))
+      continue;
+    start = (uint64)v->addrBegin;
+    for(a = a > start ? a : start; a < start + v->length; a += PGSIZE){
+      if(k == n){
+        *va = a;
+        return k;
+      }
+      if((pte = walkcursor(&c, a, 0)) == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+         (*pte & PTE_D))
+        continue;
+      if(*pte & PTE_A){
+        *pte &= ~PTE_A;
+        continue;
+      }
+      // only the cache's own copy of the page can be read again, and
+      // only if the cache holds no writes to it (see mmapsync()).
+      pa = PTE2PA(*pte);
+      if(!pcacheisclean(v->mappedFile->ip, (v->offset + (a - start)) / PGSIZE, pa))
+        continue;
+      rmapdel(pte, pa);
+      *pte = 0;
+      putref((void*)pa);
+      k++;
+    }
+  }
+  *va = MAXVA;
+  return k;
+}
+
+// Clear the PTEs of up to n clean file pages.
+// Returns the number cleared.
+static int
+dropfile(int n)
+{
+  struct proc *p;
+  int i, k = 0, visits = 0;
+
+  // Two laps of the clock at most, as in swapout().
+  while(k < n && visits <= 2*NPROC){
+    p = &proc[rec.hand];
+    acquire(&p->lock);
+    if(swappable(p)){
+      i = dropscan(p, &rec.handva, n - k);
+      // the TLB may still hold the PTEs just cleared; p
+      // flushes them when it next returns to user space.
+      if(i > 0)
+        p->tlbstale = 1;
+      k += i;
+    } else {
+      rec.handva = MAXVA;
+    }
+    release(&p->lock);
+
+    if(rec.handva >= MAXVA){
+      rec.hand = (rec.hand + 1) % NPROC;
+      rec.handva = 0;
+      visits++;
+    }
+  }
+  return k;
+}
+
+// Free some memory, trying to get n pages back.
+// Returns the number of pages freed, 0 if there is nothing
+// left to take.
+int
+reclaim(int n)
+{
+  int k, d = 0;
+
+  if((k = pcachereclaim() + ptcachedrain()) >= n || myproc() == 0 || intr_get() == 0)
+    goto out;
+
+  acquiresleep(&rec.lock);
+  if((d = dropfile(n - k)) > 0)
+    k += pcachereclaim();
+  if(k < n)
+    k += swapout(n - k);
+  releasesleep(&rec.lock);
+
+ out:
+  __sync_fetch_and_add(&rec.freed, k);
+  __sync_fetch_and_add(&rec.dropped, d);
+  return k;
+}
+
+// The reclaim thread. It looks at the free pages on every
+// clock tick.
+static void
+reclaimd(void)
+{
+  int total, nfree, k;
+
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    kmemstat(&total, &nfree);
+    if(nfree >= RECLAIMLOW)
+      continue;
+    while(nfree < RECLAIMHIGH && (k = reclaim(RECLAIMHIGH - nfree)) > 0){
+      __sync_fetch_and_add(&rec.bgfreed, k);
+      kmemstat(&total, &nfree);
+    }
+  }
+}
+
+// Report the pages freed by reclaim so far, those of them
+// the reclaim thread freed, and the file PTEs it cleared.
+void
+reclaimstat(int *freed, int *bgfreed, int *dropped)
+{
+  *freed = rec.freed;
+  *bgfreed = rec.bgfreed;
+  *dropped = rec.dropped;
+}
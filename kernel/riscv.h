@@ -227,7 +227,12 @@ w_pmpaddr0(uint64 x)
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+// address-space ID field: TLB entries are tagged with the
+// ASID of the satp that loaded them (see vm.c).
+#define SATP_ASIDSHIFT 44
+#define SATP_ASIDMASK 0xFFFFL
+
+#define MAKE_SATP(pagetable, asid) (SATP_SV39 | (((uint64)(asid) & SATP_ASIDMASK) << SATP_ASIDSHIFT) | (((uint64)pagetable) >> 12))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -349,9 +354,31 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid) : "memory");
+}
+
+// flush the TLB entry of one page of an address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid) : "memory");
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
+// walks the PTEs of a range of pages, one leaf page-table
+// page at a time (see walkcursor() in vm.c).
+struct ptcursor {
+  pagetable_t pagetable;
+  pagetable_t leaf;            // leaf page-table page of the last lookup, or 0
+  uint64 base;                 // lowest address that leaf maps
+};
+
 #endif // __ASSEMBLER__
 
 #define PGSIZE 4096 // bytes per page
@@ -365,7 +392,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed bit (read, written or fetched)
 #define PTE_D (1L << 7) // dirty bit (modified)
+#define PTE_SW (1L << 8) // software: page is in swap, PPN holds its slot (see swap.c)
+#define PTE_NS (1L << 9) // software: never swap this page out
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -379,6 +409,9 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
 
+// bytes of address space that one leaf page-table page maps.
+#define LEAFSIZE (1L << PXSHIFT(1))
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
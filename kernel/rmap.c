@@ -0,0 +1,219 @@
+// Reverse map.
+//
+// kmem.runs[] only counts the references to a physical page. The
+// reverse map also says where they are: for every user page, the
+// chain of PTEs that map it, so the kernel can find all the page
+// tables that share a page (COW after fork, the page cache, the
+// zero page) instead of only knowing how many there are.
+//
+// The code that fills in or clears a user PTE (one with PTE_U)
+// calls rmapadd() or rmapdel(): mappages() and uvmunmap(), and the
+// loops that write PTEs directly, like uvmcopy(), vmacopy() and
+// munmap(), and swap, which takes pages away from page tables and
+// gives them back. mremap() moves PTEs with rmapmove().
+//
+// Chain entries are carved out of whole pages from kalloc(), like
+// VMA descriptors (see vma.c), and a page goes back to kalloc() as
+// soon as all of its entries are free. The heads of the chains sit
+// in a table with one slot per page of RAM.
+//
+// With RMAPDEBUG set in param.h, every change checks the chain of
+// its page: each PTE in it must map the page, no PTE may be in it
+// twice, and it can't be longer than the page's reference count.
+//
+// rmap.lock protects the chains and the entry pages.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+
+#define NRAMPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+
+struct rmapent {
+  pte_t *pte;              // a PTE that maps the page
+  struct rmapent *next;
+};
+
+struct rmappage {
+  struct rmappage *prev;   // list of pages with free entries
+  struct rmappage *next;
+  struct rmapent *free;    // free entries of this page, through next
+  int nfree;
+};
+
+#define ENTSPERPAGE ((PGSIZE - sizeof(struct rmappage)) / sizeof(struct rmapent))
+
+struct {
+  struct spinlock lock;
+  struct rmapent *head[NRAMPAGES];   // chain of each page of RAM
+  struct rmappage pages;             // pages with at least one free entry
+  int nents;                         // entries in use
+  int npages;                        // pages holding entries
+} rmap;
+
+void
+rmapinit(void)
+{
+  initlock(&rmap.lock, "rmap");
+  rmap.pages.prev = &rmap.pages;
+  rmap.pages.next = &rmap.pages;
+}
+
+static struct rmapent**
+rmaphead(uint64 pa)
+{
+  if(pa % PGSIZE != 0 || pa < KERNBASE || pa >= PHYSTOP)
+    panic("rmaphead");
+  return &rmap.head[(pa - KERNBASE) / PGSIZE];
+}
+
+// Check the chain of pa. Caller must hold rmap.lock.
+static void
+rmapcheck(uint64 pa)
+{
+  struct rmapent *e, *f;
+  uint n = 0;
+
+  for(e = *rmaphead(pa); e; e = e->next){
+    if((*e->pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || PTE2PA(*e->pte) != pa)
+      panic("rmapcheck: pte");
+    for(f = e->next; f; f = f->next)
+      if(f->pte == e->pte)
+        panic("rmapcheck: twice");
+    n++;
+  }
+  if(n > getref((void*)pa))
+    panic("rmapcheck: refs");
+}
+
+// Add pte, which is about to map pa, to the chain of pa.
+// Returns 0, or -1 if out of memory.
+int
+rmapadd(pte_t *pte, uint64 pa)
+{
+  struct rmappage *pg;
+  struct rmapent *e, **head;
+  int i;
+
+  acquire(&rmap.lock);
+  pg = rmap.pages.next;
+  if(pg == &rmap.pages){
+    release(&rmap.lock);
+    if((pg = (struct rmappage*)kalloc()) == 0)
+      return -1;
+    e = (struct rmapent*)(pg + 1);
+    pg->free = 0;
+    for(i = 0; i < ENTSPERPAGE; i++){
+      e[i].next = pg->free;
+      pg->free = &e[i];
+    }
+    pg->nfree = ENTSPERPAGE;
+    acquire(&rmap.lock);
+    pg->next = rmap.pages.next;
+    pg->prev = &rmap.pages;
+    rmap.pages.next->prev = pg;
+    rmap.pages.next = pg;
+    rmap.npages++;
+  }
+
+  e = pg->free;
+  pg->free = e->next;
+  if(--pg->nfree == 0){
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+  }
+
+  if(RMAPDEBUG)
+    rmapcheck(pa);
+  head = rmaphead(pa);
+  e->pte = pte;
+  e->next = *head;
+  *head = e;
+  rmap.nents++;
+  release(&rmap.lock);
+  return 0;
+}
+
+// Take pte, which maps pa and is about to be cleared,
+// out of the chain of pa.
+void
+rmapdel(pte_t *pte, uint64 pa)
+{
+  struct rmapent *e, **ep;
+  struct rmappage *pg;
+
+  acquire(&rmap.lock);
+  for(ep = rmaphead(pa); (e = *ep) != 0; ep = &e->next)
+    if(e->pte == pte)
+      break;
+  if(e == 0)
+    panic("rmapdel");
+  *ep = e->next;
+  rmap.nents--;
+  if(RMAPDEBUG)
+    rmapcheck(pa);
+
+  pg = (struct rmappage*)PGROUNDDOWN((uint64)e);
+  e->next = pg->free;
+  pg->free = e;
+  if(pg->nfree++ == 0){
+    pg->next = rmap.pages.next;
+    pg->prev = &rmap.pages;
+    rmap.pages.next->prev = pg;
+    rmap.pages.next = pg;
+  }
+  if(pg->nfree == ENTSPERPAGE){
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    rmap.npages--;
+    release(&rmap.lock);
+    kfree(pg);
+    return;
+  }
+  release(&rmap.lock);
+}
+
+// pte, which maps pa, is moving to the PTE at to (see mremap()):
+// its entry in the chain of pa stands for to from now on.
+void
+rmapmove(pte_t *pte, pte_t *to, uint64 pa)
+{
+  struct rmapent *e;
+
+  acquire(&rmap.lock);
+  for(e = *rmaphead(pa); e; e = e->next)
+    if(e->pte == pte)
+      break;
+  if(e == 0)
+    panic("rmapmove");
+  e->pte = to;
+  release(&rmap.lock);
+}
+
+// Return the number of PTEs that map pa.
+int
+rmapcount(uint64 pa)
+{
+  struct rmapent *e;
+  int n = 0;
+
+  acquire(&rmap.lock);
+  for(e = *rmaphead(pa); e; e = e->next)
+    n++;
+  release(&rmap.lock);
+  return n;
+}
+
+// Report the entries in use and the bytes of memory
+// that the reverse map takes, its table of chains included.
+void
+rmapstat(int *ents, int *bytes)
+{
+  acquire(&rmap.lock);
+  *ents = rmap.nents;
+  *bytes = rmap.npages * PGSIZE + sizeof(rmap.head);
+  release(&rmap.lock);
+}
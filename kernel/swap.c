@@ -0,0 +1,395 @@
+// Swap space.
+//
+// When memory runs short and the page cache and file mappings have
+// nothing left to give back (see reclaim.c), swapout() evicts user
+// pages, and a later page fault on one of them brings it back with
+// swapin(). An evicted page goes to the compressed pool in memory
+// (see zswap.c) if it compresses well and the pool has room, and
+// otherwise to the swap area, the second virtio disk (SWAPDEV,
+// swap.img), if there is one.
+//
+// Victims are chosen with the clock (second chance) algorithm. The
+// hand sweeps the user PTEs of one process after another: a page the
+// hardware has marked accessed (PTE_A) since the hand last went by
+// loses the mark and stays; one that has not been touched is evicted.
+//
+// Only pages that a single PTE maps (reference count 1, see kalloc.c)
+// are evicted, i.e. anonymous memory: heap, stack, private mappings.
+// Pages shared through COW or the page cache, and those of MAP_SHARED
+// mappings (PTE_NS), stay in memory. The PTE of an evicted page keeps
+// its permissions, loses PTE_V, gets PTE_SW, and holds the number of
+// its swap slot where the PPN was. Slots below NSWAP are pages of the
+// swap area; slot NSWAP + z is entry z of the compressed pool.
+//
+// A process's page table is private to it, so the hand only looks at
+// processes that can't be using theirs: the current one, and those
+// that are sleeping or were preempted in user space, with p->lock
+// held so they don't start running meanwhile. A process preempted
+// in the middle of kernel code (p->kpreempt) may be holding a
+// physical address it took from its page table, and is skipped.
+// Kernel code of the current process that holds such an address
+// while it calls kalloc() keeps an extra reference to the page.
+//
+// Slots are reference counted, because fork() lets parent and child
+// share a page that is in swap; each gets its own copy when it
+// faults on it. A disk slot is busy while its page is being written,
+// and swapin() waits for that before reading it back. A page goes into
+// the pool at once, so those slots are never busy.
+//
+// swap.lock protects the slot counts; outlock makes swapout() calls
+// take turns, and protects the hand.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte)  ((uint)((pte) >> 10))
+#define SLOT2BLOCK(slot) ((slot) * (PGSIZE / BSIZE))
+#define ISZSLOT(slot)  ((slot) >= NSWAP)
+
+extern struct proc proc[NPROC];
+
+struct victim {
+  uint64 pa;
+  uint slot;
+};
+
+struct {
+  struct spinlock lock;
+  struct sleeplock outlock;
+  int present;           // is there a swap disk?
+  ushort ref[NSWAP+NZSWAP]; // PTEs that hold each slot
+  char busy[NSWAP];      // slot's page is being written
+  uint next;             // where to look for a free disk slot
+  int used;              // disk slots in use
+  uint64 outs;           // pages written to swap so far
+  uint64 ins;            // pages read back so far
+  uint64 zins;           // pages decompressed so far
+  uint64 intime;         // time counter ticks swapin() took for the former
+  uint64 zintime;        // and for the latter
+
+  // the clock hand, protected by outlock.
+  int hand;              // process
+  uint64 handva;         // and address in it
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.outlock, "swapout");
+  zswapinit();
+  swap.present = virtio_disk_present(SWAPDEV);
+  if(DEBUG && swap.present)
+    printf("DEBUG: swap: %d pages\n", NSWAP);
+}
+
+// Allocate a free slot, with a reference for the PTE that is going
+// to hold it, and busy until its page has been written.
+// Returns -1 if the swap area is full, or there is none.
+static int
+slotalloc(void)
+{
+  uint i, s;
+
+  if(!swap.present)
+    return -1;
+  acquire(&swap.lock);
+  for(i = 0; i < NSWAP; i++){
+    s = (swap.next + i) % NSWAP;
+    if(swap.ref[s] == 0 && !swap.busy[s]){
+      swap.ref[s] = 1;
+      swap.busy[s] = 1;
+      swap.next = s + 1;
+      swap.used++;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Drop a reference to slot. Caller must hold swap.lock.
+static void
+slotput(uint slot)
+{
+  if(slot >= NSWAP+NZSWAP || swap.ref[slot] == 0)
+    panic("slotput");
+  if(--swap.ref[slot] != 0)
+    return;
+  if(ISZSLOT(slot))
+    zfree(slot - NSWAP);
+  else if(!swap.busy[slot])
+    swap.used--;
+}
+
+// pte, which is in swap, is being copied into another page
+// table (fork): the slot gets one more reference.
+void
+swapdup(pte_t pte)
+{
+  acquire(&swap.lock);
+  swap.ref[PTE2SLOT(pte)]++;
+  release(&swap.lock);
+}
+
+// The page of *pte, which is in swap, is being unmapped:
+// drop its slot and clear the PTE.
+void
+swapdrop(pte_t *pte)
+{
+  acquire(&swap.lock);
+  slotput(PTE2SLOT(*pte));
+  release(&swap.lock);
+  *pte = 0;
+}
+
+// Can the clock hand look at the page table of p?
+// Caller must hold p->lock.
+int
+swappable(struct proc *p)
+{
+  if(p == myproc())
+    return 1;
+  return (p->state == SLEEPING || p->state == RUNNABLE) && !p->kpreempt && p->pagetable;
+}
+
+// Move the clock hand over the user pages of p, from *va up to the
+// end of the address space or until n victims are found. A page with
+// PTE_A set loses it; one without it is evicted and its PTE now points
+// to a new slot. Those compressed into the pool are freed at once and
+// counted in *zk; the others go into vic[] to be written to disk.
+// Sets *full if neither has room. Returns the number of victims in
+// vic[] and leaves *va where the hand stopped.
+static int
+swapscan(struct proc *p, uint64 *va, struct victim *vic, int n, int *zk, int *full)
+{
+  pagetable_t pt;
+  pte_t *pte;
+  uint64 a = *va, pa;
+  int k = 0, slot, z;
+
+  while(a < MAXVA && k + *zk < n){
+    // skip the parts of the address space that have no page-table page.
+    pte = &p->pagetable[PX(2, a)];
+    if((*pte & PTE_V) == 0){
+      a = (a + (1L << PXSHIFT(2))) & ~((1L << PXSHIFT(2)) - 1);
+      continue;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    pte = &pt[PX(1, a)];
+    if((*pte & PTE_V) == 0){
+      a = (a + (1L << PXSHIFT(1))) & ~((1L << PXSHIFT(1)) - 1);
+      continue;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    pte = &pt[PX(0, a)];
+
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || (*pte & PTE_NS)){
+      a += PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      a += PGSIZE;
+      continue;
+    }
+    pa = PTE2PA(*pte);
+    if(getref((void*)pa) != 1){
+      a += PGSIZE;
+      continue;
+    }
+    if((z = zstore(pa)) >= 0){
+      slot = NSWAP + z;
+      acquire(&swap.lock);
+      swap.ref[slot] = 1;
+      release(&swap.lock);
+    } else if((slot = slotalloc()) < 0){
+      // a page that didn't compress may still leave room for others.
+      if(z == -2){
+        *full = 1;
+        break;
+      }
+      a += PGSIZE;
+      continue;
+    }
+    rmapdel(pte, pa);
+    *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SW;
+    a += PGSIZE;
+    if(ISZSLOT(slot)){
+      putref((void*)pa);
+      (*zk)++;
+      continue;
+    }
+    vic[k].pa = pa;
+    vic[k].slot = slot;
+    k++;
+  }
+  *va = a;
+  return k;
+}
+
+// Write the k victims to their slots, all at once, and free them.
+static void
+swapwrite(struct victim *vic, int k)
+{
+  uint blockno[SWAPBATCH];
+  uint64 pa[SWAPBATCH];
+  int i;
+
+  for(i = 0; i < k; i++){
+    blockno[i] = SLOT2BLOCK(vic[i].slot);
+    pa[i] = vic[i].pa;
+  }
+  virtio_disk_pages(SWAPDEV, blockno, pa, k, 1);
+
+  acquire(&swap.lock);
+  for(i = 0; i < k; i++){
+    swap.busy[vic[i].slot] = 0;
+    if(swap.ref[vic[i].slot] == 0)
+      swap.used--;
+  }
+  swap.outs += k;
+  wakeup(&swap);
+  release(&swap.lock);
+
+  for(i = 0; i < k; i++)
+    putref((void*)vic[i].pa);
+}
+
+// Evict up to n user pages (at most SWAPBATCH) to the compressed
+// pool and the swap area. reclaim() calls this when memory runs
+// short, so it does nothing if the caller can't sleep, i.e. holds
+// a spinlock. Returns the number of pages freed.
+int
+swapout(int n)
+{
+  struct victim vic[SWAPBATCH];
+  struct proc *p;
+  int i, z, k = 0, zk = 0, visits = 0, full = 0;
+
+  if(myproc() == 0 || intr_get() == 0)
+    return 0;
+  if(n > SWAPBATCH)
+    n = SWAPBATCH;
+
+  acquiresleep(&swap.outlock);
+
+  // Two laps of the clock at most: the first one may do
+  // nothing but clear PTE_A bits.
+  while(k + zk < n && !full && visits <= 2*NPROC){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if(swappable(p)){
+      z = zk;
+      i = swapscan(p, &swap.handva, vic + k, n - k, &zk, &full);
+      // the TLB may still hold the PTEs just invalidated; p
+      // flushes them when it next returns to user space.
+      if(i > 0 || zk > z)
+        p->tlbstale = 1;
+      k += i;
+    } else {
+      swap.handva = MAXVA;
+    }
+    release(&p->lock);
+
+    if(swap.handva >= MAXVA){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.handva = 0;
+      visits++;
+    }
+  }
+
+  if(k > 0)
+    swapwrite(vic, k);
+
+  releasesleep(&swap.outlock);
+  return k + zk;
+}
+
+// If the page of va in pagetable is in swap, read it back (or
+// decompress it) into a new page and map it again. Returns 1 if it
+// did, 0 if the page is not in swap, and -1 if out of memory.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+  uint slot, blockno;
+  uint64 pa, t0 = r_time();
+
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0 || (*pte & PTE_SW) == 0)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return -1;
+  slot = PTE2SLOT(*pte);
+  pa = (uint64)mem;
+
+  if(ISZSLOT(slot)){
+    zload(slot - NSWAP, pa);
+  } else {
+    // the page may still be on its way to the disk.
+    acquire(&swap.lock);
+    while(swap.busy[slot])
+      sleep(&swap, &swap.lock);
+    release(&swap.lock);
+
+    blockno = SLOT2BLOCK(slot);
+    virtio_disk_pages(SWAPDEV, &blockno, &pa, 1, 0);
+  }
+  if(rmapadd(pte, pa) < 0){
+    kfree(mem);
+    return -1;
+  }
+
+  // PTE_A, so that the hand doesn't take it away again
+  // before the faulting instruction gets to use it.
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SW) | PTE_V | PTE_A;
+  tlbflush(pagetable, PGROUNDDOWN(va), 1);
+
+  acquire(&swap.lock);
+  slotput(slot);
+  if(ISZSLOT(slot)){
+    swap.zins++;
+    swap.zintime += r_time() - t0;
+  } else {
+    swap.ins++;
+    swap.intime += r_time() - t0;
+  }
+  release(&swap.lock);
+  return 1;
+}
+
+// Report the size of the swap area in pages (0 without a swap
+// disk), the slots in use, and the pages moved out and in so far.
+void
+swapstat(int *size, int *used, int *outs, int *ins)
+{
+  acquire(&swap.lock);
+  *size = swap.present ? NSWAP : 0;
+  *used = swap.used;
+  *outs = swap.outs;
+  *ins = swap.ins;
+  release(&swap.lock);
+}
+
+// Report the pages brought back from the compressed pool so far,
+// and how long swapin() takes on average, in microseconds, to bring
+// back a page from the pool and from the disk.
+void
+zswapstat(int *ins, int *zlat, int *lat)
+{
+  acquire(&swap.lock);
+  *ins = swap.zins;
+  *zlat = swap.zins ? swap.zintime / swap.zins / (TIMEHZ / 1000000) : 0;
+  *lat = swap.ins ? swap.intime / swap.ins / (TIMEHZ / 1000000) : 0;
+  release(&swap.lock);
+}
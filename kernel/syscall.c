@@ -105,6 +105,12 @@ extern uint64 sys_settickets(void);
 extern uint64 sys_getpinfo(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_ksmctl(void);
+extern uint64 sys_mremap(void);
+extern uint64 sys_mempolicy(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -136,6 +142,13 @@ static uint64 (*syscalls[])(void) = {
 
 [SYS_mmap]    sys_mmap,
 [SYS_munmap]  sys_munmap,
+[SYS_msync]   sys_msync,
+[SYS_madvise] sys_madvise,
+[SYS_mremap]  sys_mremap,
+
+[SYS_memstat] sys_memstat,
+[SYS_ksmctl]  sys_ksmctl,
+[SYS_mempolicy] sys_mempolicy,
 };
 
 void
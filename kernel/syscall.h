@@ -29,5 +29,12 @@
 
 #define SYS_mmap   24
 #define SYS_munmap 25
+#define SYS_msync  26
+#define SYS_madvise 27
+
+#define SYS_memstat 28
+#define SYS_ksmctl  29
+#define SYS_mremap  30
+#define SYS_mempolicy 31
 
 #endif
\ No newline at end of file
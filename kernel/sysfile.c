@@ -519,8 +519,11 @@ sys_mmap(void)
   argint(1, &length);
   argint(2, &prot);
   argint(3, &flags);
-  argfd(4,&fd,&f);
   argint(5,&offset);
+  if(flags & MAP_ANONYMOUS)
+    f = 0;
+  else if(argfd(4,&fd,&f) < 0)
+    return -1;
 
   return (uint64)mmap((void*)addr,length,prot,flags,f,offset);
 }
@@ -535,4 +538,48 @@ sys_munmap(void)
   argint(1, &length);
 
   return (uint64)munmap((void*)addr,length);
+}
+
+// grows, shrinks or moves a mapping
+uint64
+sys_mremap(void)
+{
+  uint64 addr;
+  int oldlen;
+  int newlen;
+  int flags;
+  argaddr(0, &addr);
+  argint(1, &oldlen);
+  argint(2, &newlen);
+  argint(3, &flags);
+
+  return (uint64)mremap((void*)addr,oldlen,newlen,flags);
+}
+
+// flushes the modified pages of a shared file mapping
+uint64
+sys_msync(void)
+{
+  uint64 addr;
+  int length;
+  int flags;
+  argaddr(0, &addr);
+  argint(1, &length);
+  argint(2, &flags);
+
+  return (uint64)msync((void*)addr,length,flags);
+}
+
+// tells how a range of mappings is going to be used
+uint64
+sys_madvise(void)
+{
+  uint64 addr;
+  int length;
+  int advice;
+  argaddr(0, &addr);
+  argint(1, &length);
+  argint(2, &advice);
+
+  return (uint64)madvise((void*)addr,length,advice);
 }
\ No newline at end of file
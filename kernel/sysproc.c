@@ -120,4 +120,43 @@ sys_getpinfo(void)
   getpinfo(pinfo);
   
   return 0;
-}
\ No newline at end of file
+}
+
+
+// returns the memory use of all processes and of the system
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+
+  if(addr == 0) return -1;
+
+  return memstat(addr);
+}
+
+// sets the pages the merge thread hashes per pass and
+// the ticks between passes
+uint64
+sys_ksmctl(void)
+{
+  int pages, interval;
+
+  argint(0, &pages);
+  argint(1, &interval);
+
+  return ksmctl(pages, interval);
+}
+
+// sets the NUMA node the process allocates memory
+// from, -1 for the node of the hart it runs on
+uint64
+sys_mempolicy(void)
+{
+  int node;
+
+  argint(0, &node);
+
+  return mempolicy(node);
+}
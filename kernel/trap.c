@@ -67,101 +67,19 @@ usertrap(void)
 
     syscall();
 
-  } else if(r_scause() == 13 || r_scause() == 15){
-    // Fallo de página al leer (13) o al escribir (15) mientras se ejecutaba código de usuario
-
-    // Primero, se comprueba si la dirección que ha dado fallo (stval) está dentro de alguna VMA
-    // (se saca la dirección del primer byte de la página en la que se encuentra para simplificar)
-    void* faultAddr = (void*)(r_stval() & ~(PGSIZE-1));
-    int vmaIndex = 0;
-    while(vmaIndex < MAX_VMAS && !(p->vmas[vmaIndex].used && (p->vmas[vmaIndex].addrBegin <= faultAddr && faultAddr < (void*)((uint64)p->vmas[vmaIndex].addrBegin + (uint64)p->vmas[vmaIndex].length)))){
-      vmaIndex++;
-    }
-
-    // La dirección no pertenece a ninguna VMA
-    if(vmaIndex >= MAX_VMAS){
-      printf("vma_address: %p \n", (void*)r_stval());
-      panic("usertrap: addr not in vmas");
-    }
-
-    // Comprobar si el fallo viene dado por falta de permisos.
-    struct VMA * v = &p->vmas[vmaIndex];
-    if(v->prot & PROT_NONE){
-      panic("usertrap: operation on non accesible memory");
-    }
-    if(!(v->prot & PROT_READ) && r_scause() == 13){
-      panic("usertrap: Read on non readable memory");
-    }
-    if(!(v->prot & PROT_WRITE) && r_scause() == 15){
-      panic("usertrap: Write on non writable memory");
-    }
-    
-
-    pte_t *pte = walk(p->pagetable, (uint64)faultAddr, 1);
-    uint64 pa = walkaddr(p->pagetable, (uint64)faultAddr);
-    int perm = PTE_U | (p->vmas[vmaIndex].prot & PROT_READ ? PTE_R : 0) | (p->vmas[vmaIndex].prot & PROT_WRITE ? PTE_W : 0);
-    //printf("DEBUG: usertrap: PROT_WRITE: %d. PTE_W: %ld. PA: %p.\n",v->prot & PROT_WRITE, *pte & PTE_W, (void*)pa);
-
-   
-    // Caso COW: Existe PA asociada a la VA, se puede escribir 
-    // en el mapeo pero no en la VA asociada a la PTE del proceso.
-    if(pa != 0 && (v->prot & PROT_WRITE) && !(*pte & PTE_W)){
-      // Caso especial asociado a desmapeo por COW.
-      // Se queda la PA antigua con una sola referencia, activar PTE_W.
-      if(getref((void*)pa) == 1){
-        if(DEBUG) printf("DEBUG: usertrap: COW, special case, activating PTE_W.\n");
-        uvmunmap(p->pagetable, (uint64)faultAddr, 1, 0);
-        mappages(p->pagetable, (uint64)faultAddr, PGSIZE, pa, perm);
-      } else {
-        // Caso general.
-        // Nueva PA para el proceso actual. -> activar PTE_W.
-        // Decrementar referencia a la antigua PA.
-        // Si tras esto la antigua PA solo tiene una referencia 
-        // activar PTE_W (cuando intente escribir el otro proceso
-        // que aún la usa, es el caso especial de arriba).
-        if(DEBUG) printf("DEBUG: usertrap: COW, removing mapping with new PA.\n");
-        uvmunmap(p->pagetable, (uint64)faultAddr, 1, 0);
-        decref((void*)pa);
-        if(DEBUG) printf("DEBUG: usertrap: Lazy alloc miss of pid %d at dir %p, mapping...\n", p->pid, faultAddr);
-        char *newPa = (char*)kalloc();
-
-        if(newPa == 0)
-          panic("usertrap: kallocn't");
-
-        memmove((void*)newPa, (void*)pa, PGSIZE);
-        mappages(p->pagetable, (uint64)faultAddr, PGSIZE, (uint64)newPa, perm);
-        if(DEBUG) printf("DEBUG: usertrap: mappages success. PA: %p\n", (void *)newPa);
-      }
-      usertrapret(); // Salimos de usertrap
-    }
-    
-    if(DEBUG) printf("DEBUG: usertrap: Lazy alloc miss of pid %d at dir %p, mapping...\n", p->pid, faultAddr);
-    // Si la dirección pertenece a una VMA, primero sacamos una página física
-    char *physPage = (char*)kalloc();
-
-    if(physPage == 0)
-      panic("usertrap: kallocn't");
-
-    // Llenamos la página de ceros por si acaso
-    memset(physPage,0,PGSIZE);
-        
-    // Ahora, la llenamos con los siguientes 4096 (como máximo) bytes de datos del fichero. Tenemos
-    // que obtener el cerrojo del fichero primero
-    struct inode* inodeptr = p->vmas[vmaIndex].mappedFile->ip;
-    uint64 fileOffset = (uint64)(p->vmas[vmaIndex].offset + (faultAddr-p->vmas[vmaIndex].addrBegin));
-
-    ilock(inodeptr);
-    readi(inodeptr,0,(uint64)physPage,fileOffset,PGSIZE);
-    iunlock(inodeptr);
-    
-    // Ahora que se ha conseguido leer el contenido a una página física, tenemos que mapearla a una
-    // página virtual en el proceso
-    if(mappages(p->pagetable,(uint64)faultAddr,PGSIZE,(uint64)physPage,perm) == 0){
-      if(DEBUG) printf("DEBUG: usertrap: mappages success. PA: %p\n", (void *)physPage);
-    } else {
-      if(DEBUG) printf("DEBUG: usertrap: mappages error.\n");
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // Fallo de página al ejecutar (12), leer (13) o escribir (15) mientras se ejecutaba código
+    // de usuario. Se leen scause y stval antes de habilitar las interrupciones, que los cambian,
+    // y se habilitan porque atender el fallo puede suponer leer del disco
+    uint64 scause = r_scause();
+    uint64 va = r_stval();
+    int access = scause == 12 ? PROT_EXEC : (scause == 15 ? PROT_WRITE : PROT_READ);
+    intr_on();
+    if(mmapfault(p, va, access) < 0){
+      printf("usertrap(): page fault scause 0x%lx pid=%d\n", scause, p->pid);
+      printf("            sepc=0x%lx stval=0x%lx\n", p->trapframe->epc, va);
+      setkilled(p);
     }
-  
 
   } else if((which_dev = devintr()) != 0){
     // ok
@@ -218,7 +136,7 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable, uvmasid(p));
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -249,8 +167,11 @@ kerneltrap()
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0)
+  if(which_dev == 2 && myproc() != 0){
+    myproc()->kpreempt = 1;
     yield();
+    myproc()->kpreempt = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -293,7 +214,9 @@ devintr()
     if(irq == UART0_IRQ){
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+      virtio_disk_intr(ROOTDEV);
+    } else if(irq == VIRTIO1_IRQ){
+      virtio_disk_intr(SWAPDEV);
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
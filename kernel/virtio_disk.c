@@ -3,6 +3,10 @@
 // uses qemu's mmio interface to virtio.
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
+//         -drive file=swap.img,if=none,format=raw,id=x1 -device virtio-blk-device,drive=x1,bus=virtio-mmio-bus.1
+//
+// the first disk holds the file system (ROOTDEV), the
+// second the swap area (SWAPDEV), which is optional.
 //
 
 #include "types.h"
@@ -16,10 +20,15 @@
 #include "buf.h"
 #include "virtio.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+#define NDISK 2
+
+// the address of virtio mmio register r of disk d.
+#define R(d, r) ((volatile uint32 *)((d)->base + (r)))
 
 static struct disk {
+  uint64 base;   // mmio registers
+  int present;
+
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -45,8 +54,9 @@ static struct disk {
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
+  // *busy is cleared when the operation finishes.
   struct {
-    struct buf *b;
+    int *busy;
     char status;
   } info[NUM];
 
@@ -56,35 +66,47 @@ static struct disk {
   
   struct spinlock vdisk_lock;
   
-} disk;
+} disks[NDISK];
 
-void
-virtio_disk_init(void)
+// the disk holding device dev.
+static struct disk *
+devdisk(uint dev)
+{
+  if(dev < 1 || dev > NDISK || !disks[dev-1].present)
+    panic("virtio disk: no such device");
+  return &disks[dev-1];
+}
+
+// set up disk d, if there is a virtio disk at base.
+// returns 0 if there isn't.
+static int
+virtio_disk_probe(struct disk *d, uint64 base)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  d->base = base;
+  initlock(&d->vdisk_lock, "virtio_disk");
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 2 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
+  if(*R(d, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(d, VIRTIO_MMIO_VERSION) != 2 ||
+     *R(d, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(d, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    return 0;
   }
   
   // reset device
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set ACKNOWLEDGE status bit
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set DRIVER status bit
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
@@ -92,73 +114,93 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // re-read status to ensure FEATURES_OK is set.
-  status = *R(VIRTIO_MMIO_STATUS);
+  status = *R(d, VIRTIO_MMIO_STATUS);
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
   // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
+  *R(d, VIRTIO_MMIO_QUEUE_SEL) = 0;
 
   // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
+  if(*R(d, VIRTIO_MMIO_QUEUE_READY))
     panic("virtio disk should not be ready");
 
   // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
   if(max < NUM)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
+  d->desc = kalloc();
+  d->avail = kalloc();
+  d->used = kalloc();
+  if(!d->desc || !d->avail || !d->used)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
+  memset(d->desc, 0, PGSIZE);
+  memset(d->avail, 0, PGSIZE);
+  memset(d->used, 0, PGSIZE);
 
   // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
 
   // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)d->desc;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)d->desc >> 32;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)d->avail;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)d->avail >> 32;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)d->used;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)d->used >> 32;
 
   // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+  *R(d, VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+    d->free[i] = 1;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
+
+  d->present = 1;
+  return 1;
+}
+
+void
+virtio_disk_init(void)
+{
+  if(!virtio_disk_probe(&disks[ROOTDEV-1], VIRTIO0))
+    panic("could not find virtio disk");
+  // the swap disk is optional; without it nothing is swapped.
+  virtio_disk_probe(&disks[SWAPDEV-1], VIRTIO1);
+
+  // plic.c and trap.c arrange for interrupts from
+  // VIRTIO0_IRQ and VIRTIO1_IRQ.
+}
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+// is there a disk for device dev?
+int
+virtio_disk_present(uint dev)
+{
+  return dev >= 1 && dev <= NDISK && disks[dev-1].present;
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct disk *d)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(d->free[i]){
+      d->free[i] = 0;
       return i;
     }
   }
@@ -167,28 +209,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct disk *d, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(d->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  d->desc[i].addr = 0;
+  d->desc[i].len = 0;
+  d->desc[i].flags = 0;
+  d->desc[i].next = 0;
+  d->free[i] = 1;
+  wakeup(&d->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct disk *d, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = d->desc[i].flags;
+    int nxt = d->desc[i].next;
+    free_desc(d, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -196,46 +238,54 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate the descriptors for n requests, three each
+// (they need not be contiguous): all of them or, if there
+// aren't enough free, none. disk transfers always use
+// three descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_reqs(struct disk *d, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
-      return -1;
-    }
-  }
+  int nfree = 0;
+
+  for(int i = 0; i < NUM; i++)
+    nfree += d->free[i];
+  if(nfree < 3*n)
+    return -1;
+  for(int i = 0; i < 3*n; i++)
+    idx[i] = alloc_desc(d);
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// wait until the descriptors for n requests are free, and
+// allocate them into idx[]. the caller holds vdisk_lock.
+// a batch takes all its descriptors before queuing any
+// request: one that slept holding some would wait for
+// descriptors that only its own wait could free, and two
+// such batches would never finish.
+static void
+reserve_reqs(struct disk *d, int *idx, int n)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  while(alloc_reqs(d, idx, n) < 0)
+    sleep(&d->free[0], &d->vdisk_lock);
+}
 
+// queue a request to transfer the len bytes at data
+// starting at sector, using the three descriptors at
+// idx, and return the index of the head of its
+// descriptor chain. *busy is set now and cleared by
+// virtio_disk_intr() when it's done. the caller holds
+// vdisk_lock and tells the device about the request.
+static int
+virtio_disk_queue(struct disk *d, int *idx, uint64 sector, uint64 data, uint len, int write, int *busy)
+{
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
   // data, one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &d->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -244,57 +294,129 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  d->desc[idx[0]].addr = (uint64) buf0;
+  d->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  d->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  d->desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+  d->desc[idx[1]].addr = data;
+  d->desc[idx[1]].len = len;
   if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    d->desc[idx[1]].flags = 0; // device reads data
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+    d->desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes data
+  d->desc[idx[1]].flags |= VRING_DESC_F_NEXT;
+  d->desc[idx[1]].next = idx[2];
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  d->info[idx[0]].status = 0xff; // device writes 0 on success
+  d->desc[idx[2]].addr = (uint64) &d->info[idx[0]].status;
+  d->desc[idx[2]].len = 1;
+  d->desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
+  d->desc[idx[2]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the busy flag for virtio_disk_intr().
+  *busy = 1;
+  d->info[idx[0]].busy = busy;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  d->avail->ring[d->avail->idx % NUM] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  d->avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  return idx[0];
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// wait for the request whose chain starts at head
+// to finish, and free its descriptors.
+// the caller holds vdisk_lock.
+static void
+virtio_disk_wait(struct disk *d, int head, int *busy)
+{
+  while(*busy == 1) {
+    sleep(busy, &d->vdisk_lock);
   }
+  d->info[head].busy = 0;
+  free_chain(d, head);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// read or write the n buffers of b[], which are all
+// on the same device, with a single notification to
+// the device, so that it can work on all of them at
+// once, and wait for them all to finish.
+// n is at most NUM/3, one descriptor chain per buffer.
+void
+virtio_disk_rwn(struct buf **b, int n, int write)
+{
+  struct disk *d = devdisk(b[0]->dev);
+  int head[NUM/3], idx[NUM];
+
+  if(n > NUM/3)
+    panic("virtio_disk_rwn");
+
+  acquire(&d->vdisk_lock);
 
-  release(&disk.vdisk_lock);
+  reserve_reqs(d, idx, n);
+  for(int i = 0; i < n; i++)
+    head[i] = virtio_disk_queue(d, &idx[3*i], (uint64)b[i]->blockno * (BSIZE / 512),
+                                (uint64)b[i]->data, BSIZE, write, &b[i]->disk);
+
+  *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(int i = 0; i < n; i++)
+    virtio_disk_wait(d, head[i], &b[i]->disk);
+
+  release(&d->vdisk_lock);
 }
 
 void
-virtio_disk_intr()
+virtio_disk_rw(struct buf *b, int write)
 {
-  acquire(&disk.vdisk_lock);
+  virtio_disk_rwn(&b, 1, write);
+}
+
+// read or write the n whole pages of physical memory
+// at pa[] from or to blocks blockno[] of device dev,
+// one page per request and all with a single
+// notification. the swap area uses this to move
+// pages without going through the buffer cache.
+// n is at most NUM/3.
+void
+virtio_disk_pages(uint dev, uint *blockno, uint64 *pa, int n, int write)
+{
+  struct disk *d = devdisk(dev);
+  int head[NUM/3], busy[NUM/3], idx[NUM];
+
+  if(n > NUM/3)
+    panic("virtio_disk_pages");
+
+  acquire(&d->vdisk_lock);
+
+  reserve_reqs(d, idx, n);
+  for(int i = 0; i < n; i++)
+    head[i] = virtio_disk_queue(d, &idx[3*i], (uint64)blockno[i] * (BSIZE / 512),
+                                pa[i], PGSIZE, write, &busy[i]);
+
+  *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+
+  for(int i = 0; i < n; i++)
+    virtio_disk_wait(d, head[i], &busy[i]);
+
+  release(&d->vdisk_lock);
+}
+
+// interrupt from the disk of device dev.
+void
+virtio_disk_intr(uint dev)
+{
+  struct disk *d = devdisk(dev);
+
+  acquire(&d->vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
@@ -302,26 +424,26 @@ virtio_disk_intr()
   // the "used" ring, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  *R(d, VIRTIO_MMIO_INTERRUPT_ACK) = *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
+  // the device increments d->used->idx when it
   // adds an entry to the used ring.
 
-  while(disk.used_idx != disk.used->idx){
+  while(d->used_idx != d->used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = d->used->ring[d->used_idx % NUM].id;
 
-    if(disk.info[id].status != 0)
+    if(d->info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    int *busy = d->info[id].busy;
+    *busy = 0;   // disk is done with the request
+    wakeup(busy);
 
-    disk.used_idx += 1;
+    d->used_idx += 1;
   }
 
-  release(&disk.vdisk_lock);
+  release(&d->vdisk_lock);
 }
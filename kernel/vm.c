@@ -5,6 +5,9 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "kalloc.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +18,76 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// Address-space IDs.
+//
+// satp carries an ASID along with the page table, and the TLB tags
+// each entry with it, so switching between the kernel page table
+// (ASID 0) and a process's needs no TLB flush, and a process finds
+// its entries still there after a system call or an interrupt.
+//
+// A process gets an ASID the first time it returns to user space,
+// and again after exec. They are handed out in order; when they run
+// out, a new generation starts, and every process gets a new ASID
+// the next time it returns to user space. Each hart flushes its
+// whole TLB once when it first sees a generation, so entries of an
+// ASID from an older generation never survive its reuse.
+//
+// Code that changes PTEs of the current process flushes their
+// entries right away with tlbflush(), one page at a time, or all of
+// the process's entries if there are more than TLBFLUSHMAX pages.
+// The PTEs of a process that isn't running (the swap clock hand
+// changes those) are flushed when it returns to user space, if
+// p->tlbstale says they changed. So are all of its entries if it
+// last ran on another hart, whose flushes this hart never saw.
+//
+// asids.lock protects the generation and the next ASID.
+struct {
+  struct spinlock lock;
+  uint64 gen;            // current generation, from 1
+  uint64 next;           // next ASID to hand out in it
+  uint64 max;            // largest ASID the hardware has, 0 if none
+  uint64 flushes;        // TLB flushes on returns to user space
+} asids;
+
+// Page-table pages.
+//
+// fork() and exec() build a page table, and exit() and exec() tear
+// one down, a page-table page at a time. Each hart keeps a small
+// cache of pages that are already zeroed (ptcaches[]), so building
+// a page table mostly takes pages from there, without kalloc() and
+// without zeroing them.
+//
+// Tearing a page table down is deferred: uvmfree() queues it, and
+// the reaper thread walks it on the next clock tick, zeroing every
+// page on the way and putting it in the cache of its hart, or back
+// to kalloc() if that one is full. If the queue is full, the page
+// table is walked right away. freeproc() calls uvmfree() holding
+// p->lock, which rules out wakeup(), so the reaper looks at the
+// queue on every tick instead of being woken.
+//
+// When memory runs short, reclaim() empties the queue and every
+// cache at once (ptcachedrain()). So a hart takes the lock of its
+// own cache too, which is almost never contended; reap.lock
+// protects the queue.
+struct ptcache {
+  struct spinlock lock;
+  void *pt[PTCACHE];
+  int n;
+} ptcaches[NCPU];
+
+struct {
+  struct spinlock lock;
+  pagetable_t q[NPROC];  // page tables to tear down
+  int n;
+  int started;           // is the reaper running?
+  uint64 hits;           // page-table pages taken from a cache
+  uint64 misses;         // and from kalloc()
+  uint64 reaped;         // queued page tables torn down
+} reap;
+
+int freewalk(pagetable_t);
+static void ptreaper(void);
+
 
 
 // Make a direct-map page table for the kernel.
@@ -29,8 +102,9 @@ kvmmake(void)
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
-  // virtio mmio disk interface
+  // virtio mmio disk interfaces
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
@@ -55,7 +129,14 @@ kvmmake(void)
 void
 kvminit(void)
 {
+  struct ptcache *pc;
+
+  for(pc = ptcaches; pc < ptcaches+NCPU; pc++)
+    initlock(&pc->lock, "ptcache");
   kernel_pagetable = kvmmake();
+  initlock(&asids.lock, "asids");
+  asids.gen = 1;
+  asids.next = 1;
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -66,12 +147,238 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  // find out how many ASID bits the hardware implements:
+  // the others read back as zero.
+  if(cpuid() == 0){
+    w_satp(MAKE_SATP(kernel_pagetable, SATP_ASIDMASK));
+    asids.max = (r_satp() >> SATP_ASIDSHIFT) & SATP_ASIDMASK;
+  }
+
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Return the ASID that p's user page table runs with, giving p one
+// if it has none in the current generation, and flush whatever TLB
+// entries of p's may be stale on this hart. usertrapret() calls this
+// with interrupts off, just before returning to user space.
+uint64
+uvmasid(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int flush, fresh = 0, all = 0;
+
+  flush = p->tlbstale || p->tlbcpu != cpuid();
+  p->tlbstale = 0;
+  p->tlbcpu = cpuid();
+
+  // without ASIDs every process runs with ASID 0, like the kernel,
+  // and the trampoline flushes the whole TLB around every switch
+  // of satp, in and out of user space.
+  if(asids.max == 0){
+    __sync_fetch_and_add(&asids.flushes, 1);
+    return 0;
+  }
+
+  acquire(&asids.lock);
+  if((p->asid >> 16) != asids.gen){
+    if(asids.next > asids.max){
+      asids.gen++;
+      asids.next = 1;
+    }
+    p->asid = (asids.gen << 16) | asids.next++;
+    fresh = 1;
+  }
+  if(c->asidgen != asids.gen){
+    c->asidgen = asids.gen;
+    all = 1;
+  }
+  release(&asids.lock);
+
+  // a fresh ASID has no entries here, but the fence still orders
+  // the page-table writes before the walks that will use them.
+  if(all)
+    sfence_vma();
+  else if(flush || fresh)
+    sfence_vma_asid(p->asid & SATP_ASIDMASK);
+  if(all || flush || fresh)
+    __sync_fetch_and_add(&asids.flushes, 1);
+  return p->asid & SATP_ASIDMASK;
+}
+
+// The PTEs of npages pages of pagetable starting at va changed:
+// flush their TLB entries, if pagetable is the current process's.
+// Other page tables are either new, and get a fresh ASID, or belong
+// to a process that isn't running, whose p->tlbstale the caller sets.
+void
+tlbflush(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct proc *p = myproc();
+  uint64 asid, i;
+
+  // without ASIDs every return to user space flushes the whole
+  // TLB, and a process without one will get a fresh one.
+  if(p == 0 || p->pagetable != pagetable || asids.max == 0 || p->asid == 0)
+    return;
+  asid = p->asid & SATP_ASIDMASK;
+  if(npages > TLBFLUSHMAX){
+    sfence_vma_asid(asid);
+    return;
+  }
+  for(i = 0; i < npages; i++)
+    sfence_vma_page(va + i*PGSIZE, asid);
+}
+
+// Report how many ASIDs processes can have (0 if the hardware has
+// none), and the TLB flushes done on returns to user space so far.
+void
+asidstat(int *n, int *flushes)
+{
+  *n = asids.max;
+  *flushes = asids.flushes;
+}
+
+// This hart's cache of page-table pages. Moving to another
+// hart meanwhile does no harm, as the caches have locks.
+static struct ptcache *
+myptcache(void)
+{
+  struct ptcache *pc;
+
+  push_off();
+  pc = &ptcaches[cpuid()];
+  pop_off();
+  return pc;
+}
+
+// Allocate a zeroed page-table page, from this hart's
+// cache if it has one. Returns 0 if out of memory.
+static pagetable_t
+ptalloc(void)
+{
+  struct ptcache *pc = myptcache();
+  void *pt = 0;
+
+  acquire(&pc->lock);
+  if(pc->n > 0)
+    pt = pc->pt[--pc->n];
+  release(&pc->lock);
+
+  if(pt){
+    __sync_fetch_and_add(&reap.hits, 1);
+    return pt;
+  }
+  __sync_fetch_and_add(&reap.misses, 1);
+  if((pt = kalloc()) != 0)
+    memset(pt, 0, PGSIZE);
+  return pt;
+}
+
+// Free page-table page pt, which must be all zeros,
+// into this hart's cache, or to kalloc() if it is full.
+// Returns 1 if it went to kalloc().
+static int
+ptfree(pagetable_t pt)
+{
+  struct ptcache *pc = myptcache();
+
+  acquire(&pc->lock);
+  if(pc->n < PTCACHE){
+    pc->pt[pc->n++] = pt;
+    pt = 0;
+  }
+  release(&pc->lock);
+  if(pt == 0)
+    return 0;
+  kfree(pt);
+  return 1;
+}
+
+// Take a page table off the reaper's queue, 0 if it is empty.
+static pagetable_t
+ptdequeue(void)
+{
+  pagetable_t pt;
+
+  acquire(&reap.lock);
+  pt = reap.n > 0 ? reap.q[--reap.n] : 0;
+  if(pt)
+    reap.reaped++;
+  release(&reap.lock);
+  return pt;
+}
+
+// Memory runs short: tear down the queued page tables now,
+// and give the pages in the caches of all harts back to
+// kalloc(). Returns the number of pages freed.
+int
+ptcachedrain(void)
+{
+  struct ptcache *pc;
+  pagetable_t pt;
+  int n = 0;
+
+  while((pt = ptdequeue()) != 0)
+    n += freewalk(pt);
+  for(pc = ptcaches; pc < ptcaches+NCPU; pc++){
+    for(;;){
+      acquire(&pc->lock);
+      pt = pc->n > 0 ? pc->pt[--pc->n] : 0;
+      release(&pc->lock);
+      if(pt == 0)
+        break;
+      kfree(pt);
+      n++;
+    }
+  }
+  return n;
+}
+
+void
+ptreapinit(void)
+{
+  initlock(&reap.lock, "reap");
+  kthread("ptreaper", ptreaper);
+  acquire(&reap.lock);
+  reap.started = 1;
+  release(&reap.lock);
+}
+
+// The reaper thread: tears down the queued page tables
+// on every clock tick.
+static void
+ptreaper(void)
+{
+  pagetable_t pt;
+
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    while((pt = ptdequeue()) != 0)
+      freewalk(pt);
+  }
+}
+
+// Report the page-table pages in the caches of the harts, how
+// many page-table pages were taken from them and how many from
+// kalloc() so far, and the queued page tables torn down.
+void
+ptstat(int *cached, int *hits, int *misses, int *reaped)
+{
+  struct ptcache *pc;
+
+  *cached = 0;
+  for(pc = ptcaches; pc < ptcaches+NCPU; pc++)
+    *cached += pc->n;
+  *hits = reap.hits;
+  *misses = reap.misses;
+  *reaped = reap.reaped;
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -95,15 +402,35 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = ptalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the PTE of va like walk(), through cursor c, which was
+// set up with { pagetable }. c remembers the leaf page-table page
+// of the last lookup, and only walks from the root when va is not
+// in it, so a loop over a range of pages goes down the three levels
+// once per LEAFSIZE bytes instead of once per page.
+pte_t *
+walkcursor(struct ptcursor *c, uint64 va, int alloc)
+{
+  pte_t *pte;
+
+  if(c->leaf == 0 || va - c->base >= LEAFSIZE){
+    if((pte = walk(c->pagetable, va, alloc)) == 0){
+      c->leaf = 0;
+      return 0;
+    }
+    c->leaf = (pagetable_t)PGROUNDDOWN((uint64)pte);
+    c->base = va & ~(LEAFSIZE - 1);
+  }
+  return &c->leaf[PX(0, va)];
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -140,13 +467,16 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// User PTEs go into the reverse map (see rmap.c).
 // Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
+// allocate a needed page-table page, or the reverse
+// map an entry.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
+  struct ptcursor c = { pagetable };
 
   if((va % PGSIZE) != 0)
     panic("mappages: va not aligned");
@@ -160,44 +490,58 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = va;
   last = va + size - PGSIZE;
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if((pte = walkcursor(&c, a, 1)) == 0)
       return -1;
-    if(*pte & PTE_V)
+    if(*pte & (PTE_V|PTE_SW))
       panic("mappages: remap");
+    if((perm & PTE_U) && rmapadd(pte, pa) < 0)
+      return -1;
     *pte = PA2PTE(pa) | perm | PTE_V;
     if(a == last)
       break;
     a += PGSIZE;
     pa += PGSIZE;
   }
+  tlbflush(pagetable, va, size / PGSIZE);
   return 0;
 }
 
 // Remove npages of mappings starting from va. va must be
 // page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// Optionally free the physical memory, a batch at a time.
+// Pages that are in swap give their swap slot back.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  struct ptcursor c = { pagetable };
+  struct pagebatch b;
+
+  b.n = 0;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
+    if((pte = walkcursor(&c, a, 0)) == 0)
       panic("uvmunmap: walk");
+    if(*pte & PTE_SW){
+      swapdrop(pte);
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
-    }
+    if(*pte & PTE_U)
+      rmapdel(pte, PTE2PA(*pte));
+    if(do_free)
+      putbatch(&b, (void*)PTE2PA(*pte));
     *pte = 0;
   }
+  tlbflush(pagetable, va, npages);
+  freebatch(&b);
 }
 
 // create an empty user page table.
@@ -205,12 +549,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
-  if(pagetable == 0)
-    return 0;
-  memset(pagetable, 0, PGSIZE);
-  return pagetable;
+  return ptalloc();
 }
 
 // Load the user initcode into address 0 of pagetable,
@@ -236,6 +575,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
   uint64 a;
+  pte_t *pte;
+  struct ptcursor c = { pagetable };
 
   if(newsz < oldsz)
     return oldsz;
@@ -248,12 +589,21 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
       return 0;
     }
     memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
+    if((pte = walkcursor(&c, a, 1)) == 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
+    if(*pte & (PTE_V|PTE_SW))
+      panic("uvmalloc: remap");
+    if(rmapadd(pte, (uint64)mem) < 0){
+      kfree(mem);
+      uvmdealloc(pagetable, a, oldsz);
+      return 0;
+    }
+    *pte = PA2PTE(mem) | PTE_R | PTE_U | xperm | PTE_V;
   }
+  tlbflush(pagetable, oldsz, (PGROUNDUP(newsz) - oldsz) / PGSIZE);
   return newsz;
 }
 
@@ -275,53 +625,96 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
-// Recursively free page-table pages.
+// Recursively free page-table pages, zeroing them
+// for the cache (see ptfree()).
 // All leaf mappings must already have been removed.
-void
+// Returns the number of pages that went back to kalloc().
+int
 freewalk(pagetable_t pagetable)
 {
+  int n = 0;
+
   // there are 2^9 = 512 PTEs in a page table.
   for(int i = 0; i < 512; i++){
     pte_t pte = pagetable[i];
     if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
       // this PTE points to a lower-level page table.
       uint64 child = PTE2PA(pte);
-      freewalk((pagetable_t)child);
-      pagetable[i] = 0;
-    } else if(pte & PTE_V){
+      n += freewalk((pagetable_t)child);
+    } else if(pte & (PTE_V|PTE_SW)){
       panic("freewalk: leaf");
     }
+    pagetable[i] = 0;
   }
-  kfree((void*)pagetable);
+  return n + ptfree(pagetable);
 }
 
-// Free user memory pages,
-// then free page-table pages.
-void
-uvmfree(pagetable_t pagetable, uint64 sz)
+// Queue pagetable for the reaper to free, or free it now
+// if the queue is full.
+static void
+ptreap(pagetable_t pagetable)
 {
-  if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  acquire(&reap.lock);
+  if(reap.started && reap.n < NELEM(reap.q)){
+    reap.q[reap.n++] = pagetable;
+    release(&reap.lock);
+    return;
+  }
+  release(&reap.lock);
   freewalk(pagetable);
 }
 
+// Count the pages of a page table, pagetable's included.
+int
+uvmptpages(pagetable_t pagetable)
+{
+  int n = 1;
+
+  for(int i = 0; i < 512; i++){
+    pte_t pte = pagetable[i];
+    if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0)
+      n += uvmptpages((pagetable_t)PTE2PA(pte));
+  }
+  return n;
+}
+
+// Free user memory pages from start to sz,
+// then free page-table pages, in the background.
+// start must be page-aligned.
+void
+uvmfree(pagetable_t pagetable, uint64 start, uint64 sz)
+{
+  if(sz > start)
+    uvmunmap(pagetable, start, (PGROUNDUP(sz) - start)/PGSIZE, 1);
+  ptreap(pagetable);
+}
+
 // Given a parent process's page table, copy
-// its memory into a child's page table.
+// its memory from start to sz into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory. Pages that are in swap
+// are not read: the child shares the slot.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
   char *mem;
+  struct ptcursor oc = { old }, nc = { new };
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
+  for(i = start; i < sz; i += PGSIZE){
+    if((pte = walkcursor(&oc, i, 0)) == 0)
       panic("uvmcopy: pte should exist");
+    if((npte = walkcursor(&nc, i, 1)) == 0)
+      goto err;
+    if(*pte & PTE_SW){
+      swapdup(*pte);
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       panic("uvmcopy: page not present");
     pa = PTE2PA(*pte);
@@ -329,33 +722,53 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+    if((flags & PTE_U) && rmapadd(npte, (uint64)mem) < 0){
       kfree(mem);
       goto err;
     }
+    *npte = PA2PTE(mem) | flags;
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
-// mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
-void
-uvmclear(pagetable_t pagetable, uint64 va)
+// Return the PTE of user virtual address va in pagetable if the
+// page is present, and writable when write is set. Pages of the
+// current process that are not are brought in the way a page
+// fault from user space would (see mmapfault()), so system calls
+// can use memory that the process has not touched yet, or that
+// is in swap. That may take two faults: one to read a page back
+// from swap, and one to copy it if it is copy-on-write.
+// Returns 0 if the page can't be accessed.
+static pte_t *
+uvmpage(pagetable_t pagetable, uint64 va, int write)
 {
+  struct proc *p = myproc();
   pte_t *pte;
-  
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    panic("uvmclear");
-  *pte &= ~PTE_U;
+  int tries;
+
+  if(va >= MAXVA)
+    return 0;
+  for(tries = 0; ; tries++){
+    pte = walk(pagetable, va, 0);
+    if(pte && (*pte & PTE_V) && (*pte & PTE_U) && (!write || (*pte & PTE_W)))
+      return pte;
+    // the fault may have to sleep (e.g. to read a file), which
+    // isn't allowed with interrupts off, i.e. holding a spinlock.
+    if(tries > 1 || p == 0 || p->pagetable != pagetable || intr_get() == 0)
+      return 0;
+    if(mmapfault(p, va, write ? PROT_WRITE : PROT_READ) < 0)
+      return 0;
+  }
 }
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Marks the pages written accessed and dirty, as a store from user
+// space would, so msync() and reclaim see the write.
 // Return 0 on success, -1 on error.
 int
   copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
@@ -365,12 +778,9 @@ int
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
-      return -1;
-    pte = walk(pagetable, va0, 0);
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
-       (*pte & PTE_W) == 0)
+    if((pte = uvmpage(pagetable, va0, 1)) == 0)
       return -1;
+    *pte |= PTE_A | PTE_D;
     pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
@@ -391,12 +801,13 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pte = uvmpage(pagetable, va0, 0)) == 0)
       return -1;
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -417,13 +828,14 @@ int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
   int got_null = 0;
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pte = uvmpage(pagetable, va0, 0)) == 0)
       return -1;
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -0,0 +1,376 @@
+// VMA index.
+//
+// Each process keeps its VMAs in an AVL tree ordered by start
+// address, rooted at p->vmaroot. VMAs never overlap, so the tree
+// finds the VMA holding any address in O(log n), and a process can
+// have many thousands of mappings.
+//
+// Every node also caches the address range its subtree spans and
+// the largest hole between two of its VMAs, so vmaplace() can find
+// room for a new mapping in O(log n) as well, reusing the holes
+// that munmap() leaves behind instead of always going further down.
+//
+// struct VMA descriptors are carved out of whole pages from kalloc().
+// Each page starts with a struct vmapage header holding the free
+// descriptors of that page, and goes back to kalloc() as soon as
+// all of its descriptors are free again.
+//
+// The tree of a process is private to it, like p->ofile, so it
+// needs no lock; vmacache.lock protects the descriptor pages.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct vmapage {
+  struct vmapage *prev;   // list of pages with free descriptors
+  struct vmapage *next;
+  struct VMA *free;       // free descriptors of this page, through left
+  int nfree;
+};
+
+#define VMASPERPAGE ((PGSIZE - sizeof(struct vmapage)) / sizeof(struct VMA))
+
+struct {
+  struct spinlock lock;
+  struct vmapage head;    // pages with at least one free descriptor
+} vmacache;
+
+void
+vmainit(void)
+{
+  initlock(&vmacache.lock, "vmacache");
+  vmacache.head.prev = &vmacache.head;
+  vmacache.head.next = &vmacache.head;
+}
+
+// Allocate a zeroed VMA descriptor.
+// Returns 0 if out of memory.
+struct VMA*
+vmaalloc(void)
+{
+  struct vmapage *pg;
+  struct VMA *v;
+  int i;
+
+  acquire(&vmacache.lock);
+  pg = vmacache.head.next;
+  if(pg == &vmacache.head){
+    release(&vmacache.lock);
+    if((pg = (struct vmapage*)kalloc()) == 0)
+      return 0;
+    v = (struct VMA*)(pg + 1);
+    pg->free = 0;
+    for(i = 0; i < VMASPERPAGE; i++){
+      v[i].left = pg->free;
+      pg->free = &v[i];
+    }
+    pg->nfree = VMASPERPAGE;
+    acquire(&vmacache.lock);
+    pg->next = vmacache.head.next;
+    pg->prev = &vmacache.head;
+    vmacache.head.next->prev = pg;
+    vmacache.head.next = pg;
+  }
+
+  v = pg->free;
+  pg->free = v->left;
+  if(--pg->nfree == 0){
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+  }
+  release(&vmacache.lock);
+
+  memset(v, 0, sizeof(*v));
+  return v;
+}
+
+// Free a VMA descriptor, and its page once the page is all free.
+void
+vmafree(struct VMA *v)
+{
+  struct vmapage *pg = (struct vmapage*)PGROUNDDOWN((uint64)v);
+
+  acquire(&vmacache.lock);
+  v->left = pg->free;
+  pg->free = v;
+  if(pg->nfree++ == 0){
+    pg->next = vmacache.head.next;
+    pg->prev = &vmacache.head;
+    vmacache.head.next->prev = pg;
+    vmacache.head.next = pg;
+  }
+  if(pg->nfree == VMASPERPAGE){
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    release(&vmacache.lock);
+    kfree(pg);
+    return;
+  }
+  release(&vmacache.lock);
+}
+
+static int
+height(struct VMA *v)
+{
+  return v ? v->height : 0;
+}
+
+static uint64
+max(uint64 a, uint64 b)
+{
+  return a > b ? a : b;
+}
+
+// Recompute the cached fields of v from its children.
+static void
+vmaupdate(struct VMA *v)
+{
+  struct VMA *l = v->left, *r = v->right;
+
+  v->height = 1 + (height(l) > height(r) ? height(l) : height(r));
+  v->lo = (uint64)v->addrBegin;
+  v->hi = (uint64)v->addrBegin + v->length;
+  v->gap = 0;
+  if(l){
+    v->lo = l->lo;
+    v->gap = max(l->gap, (uint64)v->addrBegin - l->hi);
+  }
+  if(r){
+    v->hi = r->hi;
+    v->gap = max(v->gap, max(r->gap, r->lo - ((uint64)v->addrBegin + v->length)));
+  }
+}
+
+static struct VMA*
+rotright(struct VMA *v)
+{
+  struct VMA *l = v->left;
+
+  v->left = l->right;
+  l->right = v;
+  vmaupdate(v);
+  vmaupdate(l);
+  return l;
+}
+
+static struct VMA*
+rotleft(struct VMA *v)
+{
+  struct VMA *r = v->right;
+
+  v->right = r->left;
+  r->left = v;
+  vmaupdate(v);
+  vmaupdate(r);
+  return r;
+}
+
+// Restore the AVL balance at v after one of its subtrees
+// changed height by at most one. Returns the new subtree root.
+static struct VMA*
+rebalance(struct VMA *v)
+{
+  int bal;
+
+  vmaupdate(v);
+  bal = height(v->left) - height(v->right);
+  if(bal > 1){
+    if(height(v->left->left) < height(v->left->right))
+      v->left = rotleft(v->left);
+    return rotright(v);
+  }
+  if(bal < -1){
+    if(height(v->right->right) < height(v->right->left))
+      v->right = rotright(v->right);
+    return rotleft(v);
+  }
+  return v;
+}
+
+static struct VMA*
+insert(struct VMA *root, struct VMA *v)
+{
+  if(root == 0)
+    return v;
+  if(v->addrBegin < root->addrBegin)
+    root->left = insert(root->left, v);
+  else
+    root->right = insert(root->right, v);
+  return rebalance(root);
+}
+
+// Unlink the leftmost node of root into *min.
+static struct VMA*
+removemin(struct VMA *root, struct VMA **min)
+{
+  if(root->left == 0){
+    *min = root;
+    return root->right;
+  }
+  root->left = removemin(root->left, min);
+  return rebalance(root);
+}
+
+static struct VMA*
+remove(struct VMA *root, struct VMA *v)
+{
+  struct VMA *min;
+
+  if(root == 0)
+    panic("vmaremove");
+  if(v->addrBegin < root->addrBegin){
+    root->left = remove(root->left, v);
+  } else if(v->addrBegin > root->addrBegin){
+    root->right = remove(root->right, v);
+  } else {
+    if(root != v)
+      panic("vmaremove: overlap");
+    if(v->right == 0)
+      return v->left;
+    v->right = removemin(v->right, &min);
+    min->left = v->left;
+    min->right = v->right;
+    return rebalance(min);
+  }
+  return rebalance(root);
+}
+
+// Add v, whose addrBegin and length are set, to p's VMAs.
+void
+vmainsert(struct proc *p, struct VMA *v)
+{
+  v->left = v->right = 0;
+  vmaupdate(v);
+  p->vmaroot = insert(p->vmaroot, v);
+  p->nvmas++;
+}
+
+// Take v out of p's VMAs. Does not free it.
+void
+vmaremove(struct proc *p, struct VMA *v)
+{
+  p->vmaroot = remove(p->vmaroot, v);
+  v->left = v->right = 0;
+  p->nvmas--;
+}
+
+// Return the VMA of p that contains address va, or 0.
+struct VMA*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct VMA *v = p->vmaroot;
+
+  while(v){
+    if(va < (uint64)v->addrBegin)
+      v = v->left;
+    else if(va >= (uint64)v->addrBegin + v->length)
+      v = v->right;
+    else
+      return v;
+  }
+  return 0;
+}
+
+// Return the VMA of p that contains va or, if none does, the
+// first one above va. Returns 0 if there is none.
+struct VMA*
+vmafind(struct proc *p, uint64 va)
+{
+  struct VMA *v = p->vmaroot, *above = 0;
+
+  while(v){
+    if(va < (uint64)v->addrBegin){
+      above = v;
+      v = v->left;
+    } else if(va >= (uint64)v->addrBegin + v->length){
+      v = v->right;
+    } else {
+      return v;
+    }
+  }
+  return above;
+}
+
+// Return whether every address in [start, end) is in some VMA of p.
+int
+vmamapped(struct proc *p, uint64 start, uint64 end)
+{
+  struct VMA *v;
+
+  for(v = vmafind(p, start); v && start < end; v = vmanext(p, v)){
+    if((uint64)v->addrBegin > start)
+      return 0;
+    start = (uint64)v->addrBegin + v->length;
+  }
+  return start >= end;
+}
+
+// Return the start of the highest hole of at least len bytes
+// between two VMAs of subtree v, or 0 if there is none.
+static uint64
+fit(struct VMA *v, uint64 len)
+{
+  uint64 a;
+
+  if(v == 0 || v->gap < len)
+    return 0;
+  if((a = fit(v->right, len)) != 0)
+    return a;
+  if(v->right && v->right->lo - ((uint64)v->addrBegin + v->length) >= len)
+    return v->right->lo - len;
+  if(v->left && (uint64)v->addrBegin - v->left->hi >= len)
+    return (uint64)v->addrBegin - len;
+  return fit(v->left, len);
+}
+
+// Choose where a new mapping of len bytes goes in p's address
+// space: as high as possible below the trapframe, in the first
+// hole that fits, top down, and above the heap.
+// Returns 0 if there is no room.
+uint64
+vmaplace(struct proc *p, uint64 len)
+{
+  struct VMA *root = p->vmaroot;
+  uint64 top = TRAPFRAME, bottom = PGROUNDUP(p->sz), a;
+
+  if(root == 0 || top - root->hi >= len)
+    a = top - len;
+  else if((a = fit(root, len)) == 0)
+    a = root->lo - len;
+  if(len > top || a < bottom || a > top - len)
+    return 0;
+  return a;
+}
+
+// Return the VMA of p with the lowest address, or 0 if none.
+struct VMA*
+vmafirst(struct proc *p)
+{
+  struct VMA *v = p->vmaroot;
+
+  while(v && v->left)
+    v = v->left;
+  return v;
+}
+
+// Return the VMA of p that follows v in address order, or 0.
+struct VMA*
+vmanext(struct proc *p, struct VMA *v)
+{
+  struct VMA *n = p->vmaroot, *succ = 0;
+
+  while(n){
+    if(n->addrBegin > v->addrBegin){
+      succ = n;
+      n = n->left;
+    } else {
+      n = n->right;
+    }
+  }
+  return succ;
+}
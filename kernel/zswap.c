@@ -0,0 +1,328 @@
+// Compressed swap.
+//
+// swapout() offers every page it evicts to this pool before the
+// swap disk, and uses the pool alone if there is no swap disk. The
+// page is compressed and kept in memory: bringing it back costs a
+// decompression instead of a disk read, and most pages take a small
+// fraction of a page compressed, so more of them fit in memory.
+// Pages that don't shrink to ZMAXLEN go to the disk instead.
+//
+// The compressor is a byte-oriented LZ77 in the style of LZ4: the
+// output is a series of sequences, each a token byte (literal count
+// in the high nibble, match length - 4 in the low one, 15 meaning
+// more length bytes follow), the literals, and a 2-byte offset back
+// to where the match starts in the output so far. The last sequence
+// has literals only. Matches are found through a hash table of the
+// positions of recent 4-byte sequences, so compression is a single
+// pass over the page, and decompression a loop of copies.
+//
+// The pool is made of whole pages from kalloc(), cut into ZCHUNK-byte
+// chunks: the first one holds a struct zpage header with a bitmap of
+// the chunks in use, and a compressed page takes a run of consecutive
+// chunks in one pool page. A pool page goes back to kalloc() as soon
+// as nothing is stored in it, and the pool never takes more than
+// ZPOOLPAGES pages.
+//
+// A stored page is known by its entry in zswap.ent[]. swap.c counts
+// the PTEs that refer to each entry, and frees it when none do.
+// zswap.lock protects the entries and the pool; only swapout() calls
+// zstore(), with swap.outlock held, so the compressor's buffers need
+// no lock of their own. An entry doesn't move while a PTE refers to
+// it, so zload() decompresses it without holding the lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define ZCHUNK     64
+#define ZCHUNKS    (PGSIZE / ZCHUNK)    // per pool page, header included
+#define ZMAXLEN    (PGSIZE * 3 / 4)     // longest compressed page worth keeping
+#define ZHASHBITS  12
+
+struct zpage {
+  struct zpage *next;
+  uint64 map;            // chunks in use, bit 0 the header's
+};
+
+struct zent {
+  uchar *data;           // 0 if the entry is free
+  ushort len;
+};
+
+struct {
+  struct spinlock lock;
+  struct zent ent[NZSWAP];
+  uint next;             // where to look for a free entry
+  struct zpage *pages;   // the pool
+  int npages;
+  int used;              // entries in use
+  int bytes;             // compressed bytes they hold
+  uint64 outs;           // pages stored so far
+} zswap;
+
+// the compressor's, see above.
+static ushort ztab[1 << ZHASHBITS];   // position + 1 of a recent sequence
+static uchar zbuf[ZMAXLEN];
+
+void
+zswapinit(void)
+{
+  initlock(&zswap.lock, "zswap");
+}
+
+static uint
+read32(uchar *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+// Append the extra length bytes for a count of n past 15.
+// Returns the new end of the output, or 0 if it doesn't fit.
+static uchar*
+putlen(uchar *op, uchar *end, uint n)
+{
+  for(; n >= 255; n -= 255){
+    if(op >= end)
+      return 0;
+    *op++ = 255;
+  }
+  if(op >= end)
+    return 0;
+  *op++ = n;
+  return op;
+}
+
+// Append a sequence: lit literals from s then, unless len is 0, a
+// match of len bytes off bytes back. Returns the new end of the
+// output, or 0 if it doesn't fit.
+static uchar*
+emit(uchar *op, uchar *end, uchar *s, uint lit, uint off, uint len)
+{
+  uchar *tok;
+
+  if(op >= end)
+    return 0;
+  tok = op++;
+  *tok = (lit < 15 ? lit : 15) << 4;
+  if(lit >= 15 && (op = putlen(op, end, lit - 15)) == 0)
+    return 0;
+  if(op + lit > end)
+    return 0;
+  memmove(op, s, lit);
+  op += lit;
+  if(len == 0)
+    return op;
+
+  if(op + 2 > end)
+    return 0;
+  *op++ = off;
+  *op++ = off >> 8;
+  len -= 4;
+  *tok |= len < 15 ? len : 15;
+  if(len >= 15 && (op = putlen(op, end, len - 15)) == 0)
+    return 0;
+  return op;
+}
+
+// Compress the page at src into dst, max bytes at most.
+// Returns the compressed length, or 0 if it doesn't fit.
+static int
+lzcompress(uchar *src, uchar *dst, int max)
+{
+  uchar *op = dst, *end = dst + max;
+  int i = 0, anchor = 0, ref, len;
+  uint seq, h;
+
+  memset(ztab, 0, sizeof(ztab));
+  while(i + 4 <= PGSIZE){
+    seq = read32(src + i);
+    h = (seq * 2654435761U) >> (32 - ZHASHBITS);
+    ref = ztab[h] - 1;
+    ztab[h] = i + 1;
+    if(ref < 0 || read32(src + ref) != seq){
+      i++;
+      continue;
+    }
+    for(len = 4; i + len < PGSIZE && src[ref + len] == src[i + len]; len++)
+      ;
+    if((op = emit(op, end, src + anchor, i - anchor, i - ref, len)) == 0)
+      return 0;
+    i += len;
+    anchor = i;
+  }
+  if((op = emit(op, end, src + anchor, PGSIZE - anchor, 0, 0)) == 0)
+    return 0;
+  return op - dst;
+}
+
+// Decompress the n bytes at src into the page dst.
+static void
+lzdecompress(uchar *src, int n, uchar *dst)
+{
+  uchar *ip = src, *iend = src + n, *op = dst, *oend = dst + PGSIZE;
+  uint tok, lit, len, off, b;
+
+  while(ip < iend){
+    tok = *ip++;
+    if((lit = tok >> 4) == 15){
+      do {
+        b = *ip++;
+        lit += b;
+      } while(b == 255);
+    }
+    if(op + lit > oend || ip + lit > iend)
+      panic("lzdecompress");
+    memmove(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if(ip >= iend)
+      break;
+
+    off = ip[0] | ip[1] << 8;
+    ip += 2;
+    if((len = (tok & 15) + 4) == 15 + 4){
+      do {
+        b = *ip++;
+        len += b;
+      } while(b == 255);
+    }
+    if(off == 0 || off > op - dst || op + len > oend)
+      panic("lzdecompress");
+    // the match may overlap what it is copied to.
+    for(; len > 0; len--, op++)
+      *op = *(op - off);
+  }
+  if(op != oend)
+    panic("lzdecompress");
+}
+
+// Find n free chunks in a row in the pool page with bitmap map.
+// Returns the first, or -1 if there aren't.
+static int
+findrun(uint64 map, int n)
+{
+  int i, run = 0;
+
+  for(i = 1; i < ZCHUNKS; i++){
+    if(map & (1UL << i))
+      run = 0;
+    else if(++run == n)
+      return i - n + 1;
+  }
+  return -1;
+}
+
+// Compress the page pa into the pool. Caller must hold swap.outlock.
+// Returns its entry, -1 if the page doesn't compress well enough,
+// and -2 if the pool is full.
+int
+zstore(uint64 pa)
+{
+  struct zpage *zp;
+  struct zent *e;
+  int len, n, c;
+  uint i;
+
+  // only zstore() adds entries, so the pool can't fill up meanwhile.
+  if(zswap.used == NZSWAP)
+    return -2;
+  if((len = lzcompress((uchar*)pa, zbuf, ZMAXLEN)) == 0)
+    return -1;
+  n = (len + ZCHUNK - 1) / ZCHUNK;
+
+  acquire(&zswap.lock);
+  for(;;){
+    for(zp = zswap.pages; zp; zp = zp->next)
+      if((c = findrun(zp->map, n)) >= 0)
+        goto found;
+    if(zswap.npages >= ZPOOLPAGES){
+      release(&zswap.lock);
+      return -2;
+    }
+    release(&zswap.lock);
+    if((zp = (struct zpage*)kalloc()) == 0)
+      return -2;
+    zp->map = 1;
+    acquire(&zswap.lock);
+    zp->next = zswap.pages;
+    zswap.pages = zp;
+    zswap.npages++;
+  }
+
+ found:
+  zp->map |= ((1UL << n) - 1) << c;
+  for(i = 0; ; i++){
+    e = &zswap.ent[(zswap.next + i) % NZSWAP];
+    if(e->data == 0)
+      break;
+  }
+  zswap.next = (e - zswap.ent) + 1;
+  e->data = (uchar*)zp + c*ZCHUNK;
+  e->len = len;
+  memmove(e->data, zbuf, len);
+  zswap.used++;
+  zswap.bytes += len;
+  zswap.outs++;
+  release(&zswap.lock);
+  return e - zswap.ent;
+}
+
+// Decompress the page stored in entry z into page pa.
+void
+zload(int z, uint64 pa)
+{
+  struct zent *e = &zswap.ent[z];
+
+  if(z < 0 || z >= NZSWAP || e->data == 0)
+    panic("zload");
+  lzdecompress(e->data, e->len, (uchar*)pa);
+}
+
+// Free entry z, and its pool page if nothing else is stored there.
+void
+zfree(int z)
+{
+  struct zent *e = &zswap.ent[z];
+  struct zpage *zp, **pp;
+  int n, c;
+
+  acquire(&zswap.lock);
+  if(z < 0 || z >= NZSWAP || e->data == 0)
+    panic("zfree");
+  zp = (struct zpage*)PGROUNDDOWN((uint64)e->data);
+  c = (e->data - (uchar*)zp) / ZCHUNK;
+  n = (e->len + ZCHUNK - 1) / ZCHUNK;
+  zp->map &= ~(((1UL << n) - 1) << c);
+  zswap.used--;
+  zswap.bytes -= e->len;
+  e->data = 0;
+  e->len = 0;
+
+  if(zp->map == 1){
+    for(pp = &zswap.pages; *pp != zp; pp = &(*pp)->next)
+      ;
+    *pp = zp->next;
+    zswap.npages--;
+    release(&zswap.lock);
+    kfree(zp);
+    return;
+  }
+  release(&zswap.lock);
+}
+
+// Report the pages stored in the pool, their compressed size in
+// bytes, the pages the pool takes, and the pages stored so far.
+void
+zstat(int *used, int *bytes, int *pages, int *outs)
+{
+  acquire(&zswap.lock);
+  *used = zswap.used;
+  *bytes = zswap.bytes;
+  *pages = zswap.npages;
+  *outs = zswap.outs;
+  release(&zswap.lock);
+}
@@ -6,10 +6,40 @@
 #include "kernel/fs.h"
 #include "user/user.h"
 #include "kernel/proc.h"
+#include "kernel/pstat.h"
+#include "kernel/memstat.h"
 
 void mmap_test();
 void fork_test();
 void custom_test();
+void pcache_test();
+void scan_bench();
+void anon_test();
+void many_test();
+void hole_test();
+void msync_test();
+void sync_bench();
+int mywbpages();
+void madvise_test();
+void populate_test();
+void exec_test();
+void exec_child();
+void share_test();
+void share_child(char *argv[]);
+void swap_test();
+void tlb_test();
+void tlb_bench();
+void zero_test();
+void memstat_test();
+void rmap_test();
+void reclaim_test();
+void ksm_test();
+void mremap_test();
+void zswap_test();
+void numa_bench();
+void exitfree_test();
+void ptcache_bench();
+void bigshare_test();
 char buf[BSIZE];
 
 #define MAP_FAILED ((char *) -1)
@@ -17,9 +47,38 @@ char buf[BSIZE];
 int
 main(int argc, char *argv[])
 {
+  if(argc > 1 && strcmp(argv[1], "exec") == 0)
+    exec_child();
+  if(argc > 3 && strcmp(argv[1], "share") == 0)
+    share_child(argv);
   custom_test();
   mmap_test();
   fork_test();
+  pcache_test();
+  anon_test();
+  many_test();
+  hole_test();
+  msync_test();
+  madvise_test();
+  scan_bench();
+  sync_bench();
+  populate_test();
+  exec_test();
+  share_test();
+  swap_test();
+  tlb_test();
+  tlb_bench();
+  zero_test();
+  memstat_test();
+  rmap_test();
+  reclaim_test();
+  ksm_test();
+  mremap_test();
+  zswap_test();
+  numa_bench();
+  exitfree_test();
+  ptcache_bench();
+  bigshare_test();
   printf("mmaptest: all tests succeeded\n");
   exit(0);
 }
@@ -329,3 +388,1756 @@ fork_test(void)
   printf("fork_test OK\n");
 }
 
+//
+// two processes that map the same file MAP_SHARED on their own
+// (not inherited through fork) must share the physical pages,
+// and read()/write() must see the same bytes as the mappings.
+//
+void
+pcache_test(void)
+{
+  int fd;
+  int pid;
+  int status;
+  int tochild[2], toparent[2];
+  char c;
+  char *p;
+  const char * const f = "mmap.dur";
+
+  printf("pcache_test starting\n");
+  testname = "pcache_test";
+
+  makefile(f);
+  if(pipe(tochild) < 0 || pipe(toparent) < 0)
+    err("pipe");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if((fd = open(f, O_RDWR)) == -1)
+      err("open (child)");
+    p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+      err("mmap (child)");
+    // wait until the parent has mapped the file too.
+    if(read(tochild[0], &c, 1) != 1)
+      err("read pipe (child)");
+    p[0] = 'X';
+    p[PGSIZE] = 'Y';
+    if(write(toparent[1], "w", 1) != 1)
+      err("write pipe (child)");
+    // keep the mapping until the parent has looked at it.
+    if(read(tochild[0], &c, 1) != 1)
+      err("read pipe (child)");
+    munmap(p, PGSIZE*2);
+    exit(0);
+  }
+
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  if(p[0] != 'A')
+    err("initial content");
+  if(write(tochild[1], "m", 1) != 1)
+    err("write pipe");
+  if(read(toparent[0], &c, 1) != 1)
+    err("read pipe");
+
+  // the child's stores must be visible before anybody unmaps.
+  if(p[0] != 'X' || p[PGSIZE] != 'Y')
+    err("shared mapping does not share pages");
+
+  // read() must see the mapped page, not the stale disk block.
+  if(read(fd, &c, 1) != 1 || c != 'X')
+    err("read() does not see mapping writes");
+
+  // write() must show up in the mapping.
+  if(write(fd, "Q", 1) != 1)
+    err("write");
+  if(p[1] != 'Q')
+    err("mapping does not see write()");
+
+  if(write(tochild[1], "d", 1) != 1)
+    err("write pipe");
+  wait(&status);
+  if(status != 0)
+    err("child failed");
+  munmap(p, PGSIZE*2);
+  close(fd);
+  close(tochild[0]);
+  close(tochild[1]);
+  close(toparent[0]);
+  close(toparent[1]);
+
+  printf("pcache_test OK\n");
+}
+
+//
+// MAP_ANONYMOUS mappings: zero-filled, private ones copied on write
+// across fork, shared ones seen by parent and child alike, and
+// large malloc() blocks placed in their own mappings.
+//
+void
+anon_test(void)
+{
+  int i, pid, status;
+  char *p, *s, *m;
+
+  printf("anon_test starting\n");
+  testname = "anon_test";
+
+  p = mmap(0, PGSIZE*4, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap private");
+  s = mmap(0, PGSIZE*4, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(s == MAP_FAILED)
+    err("mmap shared");
+  for(i = 0; i < PGSIZE*4; i++)
+    if(p[i] != 0 || s[i] != 0)
+      err("not zero-filled");
+  p[0] = 'p';
+  s[PGSIZE*3] = 's';
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if(p[0] != 'p' || s[PGSIZE*3] != 's')
+      err("child does not see parent's data");
+    p[0] = 'c';
+    p[PGSIZE] = 'c';
+    s[0] = 'c';
+    exit(0);
+  }
+  wait(&status);
+  if(status != 0)
+    err("child failed");
+  if(p[0] != 'p' || p[PGSIZE] != 0)
+    err("private anonymous mapping not private");
+  if(s[0] != 'c')
+    err("shared anonymous mapping not shared");
+  if(munmap(p, PGSIZE*4) == -1 || munmap(s, PGSIZE*4) == -1)
+    err("munmap");
+
+  // large blocks live in their own mappings, above the heap,
+  // and can be allocated and freed over and over.
+  for(i = 0; i < 32; i++){
+    if((m = malloc(256*1024)) == 0)
+      err("malloc");
+    if((uint64)m < (uint64)sbrk(0))
+      err("large block not mapped");
+    m[0] = m[256*1024-1] = 'm';
+    free(m);
+  }
+
+  printf("anon_test OK\n");
+}
+
+#define NMANY 2000
+
+char *many[NMANY];
+
+//
+// many small mappings at once: every one of them must still be
+// found on a fault and by munmap, whatever order they go away in.
+//
+void
+many_test(void)
+{
+  int i, t0;
+
+  printf("many_test starting\n");
+  testname = "many_test";
+
+  t0 = uptime();
+  for(i = 0; i < NMANY; i++){
+    many[i] = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(many[i] == MAP_FAILED)
+      err("mmap");
+    many[i][i % PGSIZE] = i;
+  }
+  for(i = 0; i < NMANY; i++)
+    if(many[i][i % PGSIZE] != (char)i)
+      err("wrong data");
+
+  // drop every other mapping, then check and drop the rest.
+  for(i = 0; i < NMANY; i += 2)
+    if(munmap(many[i], PGSIZE) == -1)
+      err("munmap even");
+  for(i = 1; i < NMANY; i += 2){
+    if(many[i][i % PGSIZE] != (char)i)
+      err("wrong data after munmap");
+    if(munmap(many[i], PGSIZE) == -1)
+      err("munmap odd");
+  }
+  printf("many_test: %d mappings in %d ticks\n", NMANY, uptime() - t0);
+
+  printf("many_test OK\n");
+}
+
+//
+// munmap can punch a hole in the middle of a mapping, and later
+// mappings reuse the holes instead of going further down.
+//
+void
+hole_test(void)
+{
+  int i;
+  char *p, *q, *first;
+
+  printf("hole_test starting\n");
+  testname = "hole_test";
+
+  p = mmap(0, PGSIZE*3, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  p[0] = 'a';
+  p[PGSIZE] = 'b';
+  p[PGSIZE*2] = 'c';
+
+  // split the mapping in two around its middle page.
+  if(munmap(p+PGSIZE, PGSIZE) == -1)
+    err("munmap middle");
+  if(p[0] != 'a' || p[PGSIZE*2] != 'c')
+    err("lost data around the hole");
+
+  // the hole is the first one that fits from the top.
+  q = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(q != p+PGSIZE)
+    err("hole not reused");
+  if(q[0] != 0)
+    err("reused hole not zero-filled");
+
+  // one munmap can span several mappings.
+  if(munmap(p, PGSIZE*3) == -1)
+    err("munmap all");
+
+  // map and unmap over and over: the address space does not creep down.
+  first = 0;
+  for(i = 0; i < 100; i++){
+    p = mmap(0, PGSIZE*16, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+      err("mmap loop");
+    if(first == 0)
+      first = p;
+    if(p != first)
+      err("address space leaks");
+    p[PGSIZE*15] = i;
+    if(munmap(p, PGSIZE*16) == -1)
+      err("munmap loop");
+  }
+
+  printf("hole_test OK\n");
+}
+
+//
+// msync writes back what was modified, and only that.
+//
+void
+msync_test(void)
+{
+  int i, fd, wb, fds[2];
+  char *p;
+  const char * const f = "mmap.dur";
+
+  printf("msync_test starting\n");
+  testname = "msync_test";
+
+  makefile(f);
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+
+  if(msync(p+1, PGSIZE, MS_SYNC) != -1)
+    err("msync unaligned");
+  if(msync(p, PGSIZE, MS_SYNC | MS_ASYNC) != -1)
+    err("msync with both modes");
+  if(msync(p, PGSIZE*3, MS_SYNC) != -1)
+    err("msync past the mapping");
+
+  // reading does not make a page dirty.
+  _v1(p);
+  wb = mywbpages();
+  if(msync(p, PGSIZE*2, MS_SYNC) == -1)
+    err("msync clean");
+  if(mywbpages() != wb)
+    err("clean pages written back");
+
+  // a write dirties just its page, once.
+  p[PGSIZE] = 'Z';
+  if(msync(p, PGSIZE*2, MS_SYNC) == -1)
+    err("msync dirty");
+  if(mywbpages() != wb + 1)
+    err("dirty page not written back");
+  if(msync(p, PGSIZE*2, MS_SYNC) == -1 || mywbpages() != wb + 1)
+    err("page written back twice");
+
+  // MS_ASYNC leaves the write for a later MS_SYNC or munmap.
+  p[0] = 'Y';
+  if(msync(p, PGSIZE*2, MS_ASYNC) == -1)
+    err("msync async");
+  if(mywbpages() != wb + 1)
+    err("MS_ASYNC wrote synchronously");
+  if(munmap(p, PGSIZE*2) == -1)
+    err("munmap");
+  if(mywbpages() != wb + 2)
+    err("async page not written back on munmap");
+
+  if(read(fd, buf, 1) != 1 || buf[0] != 'Y')
+    err("file does not have the write");
+
+  // a write by the kernel, read() into the mapping, dirties the page too.
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  if(pipe(fds) < 0)
+    err("pipe");
+  if(write(fds[1], "kernel", 6) != 6)
+    err("write pipe");
+  if(read(fds[0], p + PGSIZE, 6) != 6)
+    err("read into the mapping");
+  close(fds[0]);
+  close(fds[1]);
+  if(munmap(p, PGSIZE*2) == -1)
+    err("munmap");
+  if(mywbpages() != wb + 3)
+    err("page written by read() not written back on munmap");
+  close(fd);
+
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  for(i = 0; i < PGSIZE/BSIZE; i++)
+    if(read(fd, buf, BSIZE) != BSIZE)
+      err("read");
+  if(read(fd, buf, 6) != 6 || memcmp(buf, "kernel", 6) != 0)
+    err("file does not have the write by read()");
+  close(fd);
+  unlink(f);
+
+  printf("msync_test OK\n");
+}
+
+//
+// number of free pages, found by growing a child's heap until
+// the kernel runs out of memory.
+//
+int
+countfree(void)
+{
+  int pid, n = 0;
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    while(sbrk(64*PGSIZE) != (char*)-1)
+      n += 64;
+    while(sbrk(PGSIZE) != (char*)-1)
+      n++;
+    exit(n);
+  }
+  wait(&n);
+  return n;
+}
+
+#define NADVISE 256
+
+//
+// madvise hints are checked, split mappings like munmap does,
+// and MADV_DONTNEED gives the pages back to the kernel.
+//
+void
+madvise_test(void)
+{
+  int fd, i, free0, free1;
+  char *p;
+  const char * const f = "mmap.dur";
+
+  printf("madvise_test starting\n");
+  testname = "madvise_test";
+
+  p = mmap(0, PGSIZE*NADVISE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  if(madvise(p+1, PGSIZE, MADV_RANDOM) != -1)
+    err("madvise unaligned");
+  if(madvise(p, PGSIZE, 99) != -1)
+    err("madvise bad advice");
+  if(madvise(p, PGSIZE*(NADVISE+1), MADV_RANDOM) != -1)
+    err("madvise past the mapping");
+
+  // advice for part of a mapping splits it.
+  if(madvise(p+PGSIZE, PGSIZE, MADV_SEQUENTIAL) == -1)
+    err("madvise sequential");
+  for(i = 0; i < NADVISE; i++)
+    p[i*PGSIZE] = 'a';
+
+  // dropped anonymous pages come back zeroed, and are free meanwhile.
+  free0 = countfree();
+  if(madvise(p, PGSIZE*NADVISE, MADV_DONTNEED) == -1)
+    err("madvise dontneed");
+  free1 = countfree();
+  for(i = 0; i < NADVISE; i++)
+    if(p[i*PGSIZE] != 0)
+      err("dropped page not zero-filled");
+  printf("MADV_DONTNEED: %d pages dirtied, %d pages freed\n", NADVISE, free1 - free0);
+  if(free1 - free0 < NADVISE/2)
+    err("MADV_DONTNEED did not free memory");
+  if(munmap(p, PGSIZE*NADVISE) == -1)
+    err("munmap anonymous");
+
+  // dropped private file pages are read again from the file.
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap file");
+  if(madvise(p, PGSIZE*2, MADV_WILLNEED) == -1)
+    err("madvise willneed");
+  p[0] = 'Z';
+  if(madvise(p, PGSIZE*2, MADV_DONTNEED) == -1)
+    err("madvise dontneed file");
+  _v1(p);
+  if(munmap(p, PGSIZE*2) == -1)
+    err("munmap file");
+  close(fd);
+  unlink(f);
+
+  printf("madvise_test OK\n");
+}
+
+//
+// this process's slot in st.
+//
+int
+myslot(struct pstat *st)
+{
+  int pid = getpid();
+
+  getpinfo(st);
+  for(int i = 0; i < NPROC; i++)
+    if(st->inuse[i] && st->pid[i] == pid)
+      return i;
+  err("getpinfo");
+  return 0;
+}
+
+//
+// number of page faults this process has taken so far.
+//
+int
+myfaults(void)
+{
+  struct pstat st;
+
+  return st.faults[myslot(&st)];
+}
+
+//
+// number of mapped pages this process has written back so far.
+//
+int
+mywbpages(void)
+{
+  struct pstat st;
+
+  return st.wbpages[myslot(&st)];
+}
+
+#define BENCHPAGES ((int)(MAXFILE*BSIZE)/PGSIZE)
+#define BENCHROUNDS 4
+
+//
+// create a file of BENCHPAGES pages, each filled with its own
+// page number. a file that existed is replaced, so none of its
+// pages are cached any more.
+//
+void
+makebig(const char *f)
+{
+  int fd, i;
+
+  unlink(f);
+  if((fd = open(f, O_RDWR | O_CREATE)) == -1)
+    err("open");
+  for(i = 0; i < BENCHPAGES*(PGSIZE/BSIZE); i++){
+    memset(buf, i / (PGSIZE/BSIZE), BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE)
+      err("write");
+  }
+  close(fd);
+}
+
+//
+// scan a mapped file of BENCHPAGES pages BENCHROUNDS times, one
+// page after another or in a scattered order, and report the page
+// faults per MiB scanned and the throughput. the first round starts
+// with nothing cached, since the file has just been rewritten.
+// advice, if not MADV_NORMAL, is given to madvise for the mapping.
+//
+void
+scan(const char *f, int random, int advice)
+{
+  int fd, i, r, pg;
+  int faults0, ticks0, faults, ticks;
+  uint sum = 0;
+  char *p;
+
+  makebig(f);
+
+  faults0 = myfaults();
+  ticks0 = uptime();
+  for(r = 0; r < BENCHROUNDS; r++){
+    if((fd = open(f, O_RDONLY)) == -1)
+      err("open");
+    p = mmap(0, BENCHPAGES*PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED)
+      err("mmap");
+    if(advice != MADV_NORMAL && madvise(p, BENCHPAGES*PGSIZE, advice) == -1)
+      err("madvise");
+    for(i = 0; i < BENCHPAGES; i++){
+      // 37 and BENCHPAGES share no factor, so this visits every page once.
+      pg = random ? (i * 37) % BENCHPAGES : i;
+      if(p[pg*PGSIZE] != (char)pg || p[pg*PGSIZE + PGSIZE-1] != (char)pg)
+        err("scan content");
+      for(int j = 0; j < PGSIZE; j += 64)
+        sum += p[pg*PGSIZE + j];
+    }
+    if(munmap(p, BENCHPAGES*PGSIZE) == -1)
+      err("munmap");
+    close(fd);
+  }
+  faults = myfaults() - faults0;
+  ticks = uptime() - ticks0;
+  if(ticks == 0)
+    ticks = 1;
+
+  // BENCHROUNDS*BENCHPAGES*PGSIZE bytes were scanned.
+  printf("%s scan%s: %d faults, %d faults/MiB, %d KiB/tick (sum %d)\n",
+         random ? "random" : "sequential",
+         advice == MADV_SEQUENTIAL ? " (MADV_SEQUENTIAL)" :
+         advice == MADV_RANDOM ? " (MADV_RANDOM)" : "", faults,
+         faults * 256 / (BENCHROUNDS*BENCHPAGES),
+         (BENCHROUNDS*BENCHPAGES*(PGSIZE/1024)) / ticks, sum);
+  unlink(f);
+}
+
+void
+scan_bench(void)
+{
+  printf("scan_bench starting\n");
+  testname = "scan_bench";
+  scan("mmap.big", 0, MADV_NORMAL);
+  scan("mmap.big", 0, MADV_SEQUENTIAL);
+  scan("mmap.big", 1, MADV_NORMAL);
+  scan("mmap.big", 1, MADV_RANDOM);
+  printf("scan_bench OK\n");
+}
+
+//
+// a read-mostly workload on a shared mapping: every round reads
+// the whole file and writes one page in 16, then msyncs. report
+// how many pages go to disk and how long the msyncs take.
+//
+void
+sync_bench(void)
+{
+  int fd, i, r, wb0, ticks0, wb, ticks;
+  uint sum = 0;
+  char *p;
+  const char * const f = "mmap.big";
+
+  printf("sync_bench starting\n");
+  testname = "sync_bench";
+
+  makebig(f);
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, BENCHPAGES*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+
+  wb = ticks = 0;
+  for(r = 0; r < BENCHROUNDS; r++){
+    for(i = 0; i < BENCHPAGES; i++)
+      for(int j = 0; j < PGSIZE; j += 64)
+        sum += p[i*PGSIZE + j];
+    for(i = r; i < BENCHPAGES; i += 16)
+      p[i*PGSIZE] = i;
+    wb0 = mywbpages();
+    ticks0 = uptime();
+    if(msync(p, BENCHPAGES*PGSIZE, MS_SYNC) == -1)
+      err("msync");
+    ticks += uptime() - ticks0;
+    wb += mywbpages() - wb0;
+  }
+  if(munmap(p, BENCHPAGES*PGSIZE) == -1)
+    err("munmap");
+  close(fd);
+  unlink(f);
+
+  printf("read-mostly msync: %d of %d resident pages written back, %d ticks (sum %d)\n",
+         wb, BENCHROUNDS*BENCHPAGES, ticks, sum);
+  printf("sync_bench OK\n");
+}
+
+//
+// map a cold file of BENCHPAGES pages and read all of it, once
+// populating the mapping on demand and once with MAP_POPULATE.
+// report the time spent in mmap and in reading, and the faults
+// taken while reading, which MAP_POPULATE should bring to zero.
+//
+void
+populate(const char *f, int flags)
+{
+  int fd, i, t0, t1, t2, faults0, faults;
+  char *p;
+
+  makebig(f);
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  t0 = uptime();
+  p = mmap(0, BENCHPAGES*PGSIZE, PROT_READ, MAP_PRIVATE | flags, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  t1 = uptime();
+  faults0 = myfaults();
+  for(i = 0; i < BENCHPAGES; i++)
+    if(p[i*PGSIZE] != (char)i || p[i*PGSIZE + PGSIZE-1] != (char)i)
+      err("populated content");
+  faults = myfaults() - faults0;
+  t2 = uptime();
+  if(munmap(p, BENCHPAGES*PGSIZE) == -1)
+    err("munmap");
+  close(fd);
+  unlink(f);
+
+  printf("%s: mmap %d ticks, reading %d ticks, %d faults\n",
+         flags & MAP_POPULATE ? "MAP_POPULATE" : "on demand", t1 - t0, t2 - t1, faults);
+  if((flags & MAP_POPULATE) && faults != 0)
+    err("faults after MAP_POPULATE");
+}
+
+void
+populate_test(void)
+{
+  int i, faults0;
+  char *p;
+
+  printf("populate_test starting\n");
+  testname = "populate_test";
+
+  populate("mmap.big", 0);
+  populate("mmap.big", MAP_POPULATE);
+
+  // anonymous private memory is populated zeroed and writable.
+  p = mmap(0, PGSIZE*16, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap anonymous");
+  faults0 = myfaults();
+  for(i = 0; i < PGSIZE*16; i += PGSIZE){
+    if(p[i] != 0)
+      err("not zero-filled");
+    p[i] = 'x';
+  }
+  if(myfaults() != faults0)
+    err("faults on populated anonymous memory");
+  if(munmap(p, PGSIZE*16) == -1)
+    err("munmap anonymous");
+
+  printf("populate_test OK\n");
+}
+
+#define EXECBSS 256
+#define NEXEC 10
+
+// bss that is never touched, except by exec_child. it costs
+// nothing as long as exec zero-fills bss on demand.
+char execbss[EXECBSS*PGSIZE];
+int execdata = 0x5eed;
+
+//
+// run as "mmaptest exec" by exec_test: check the data and bss of
+// a fresh image, and that the pages not touched were not loaded.
+// the exit status tells exec_test what went wrong, if anything.
+//
+void
+exec_child(void)
+{
+  if(execdata != 0x5eed)
+    exit(1);
+  execdata = 1;
+  if(execbss[0] != 0 || execbss[EXECBSS*PGSIZE-1] != 0)
+    exit(2);
+  execbss[PGSIZE] = 1;
+  if(myfaults() >= EXECBSS)
+    exit(3);
+  exit(0);
+}
+
+//
+// exec maps the program image instead of reading it: writes to
+// its data stay private to each process, bss is zeroed, and only
+// the touched pages are faulted in. report how long NEXEC
+// fork+exec+exit rounds take.
+//
+void
+exec_test(void)
+{
+  int i, pid, xstatus, ticks0;
+  char *argv[] = { "mmaptest", "exec", 0 };
+
+  printf("exec_test starting\n");
+  testname = "exec_test";
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    execdata = 2;
+    execbss[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || execdata != 0x5eed || execbss[0] != 0)
+    err("data written by the child seen by the parent");
+
+  ticks0 = uptime();
+  for(i = 0; i < NEXEC; i++){
+    if((pid = fork()) < 0)
+      err("fork");
+    if(pid == 0){
+      exec("mmaptest", argv);
+      exit(4);
+    }
+    wait(&xstatus);
+    if(xstatus == 1)
+      err("wrong initialized data");
+    if(xstatus == 2)
+      err("bss not zeroed");
+    if(xstatus == 3)
+      err("image not paged in on demand");
+    if(xstatus != 0)
+      err("exec");
+  }
+  printf("%d fork+exec of a %d KB program: %d ticks\n", NEXEC,
+         (int)((uint64)sbrk(0) / 1024), uptime() - ticks0);
+
+  printf("exec_test OK\n");
+}
+
+#define NSHARE 20
+
+//
+// run as "mmaptest share <ready fd> <go fd>" by share_test: read
+// every page of the program's code, say so on the ready pipe, and
+// wait on the go pipe to exit.
+//
+void
+share_child(char *argv[])
+{
+  volatile uint64 zero = 0;
+  int ready = atoi(argv[2]), go = atoi(argv[3]);
+  char *a, c = 0;
+
+  for(a = (char*)zero; a < (char*)&execdata; a += PGSIZE)
+    c += *a;
+  if(write(ready, &c, 1) != 1)
+    exit(1);
+  read(go, &c, 1);
+  exit(0);
+}
+
+//
+// NSHARE processes running the same program share one copy of
+// its code: report how many pages that saves. then overwrite the
+// program file under them; they must keep running the code they
+// started with.
+//
+void
+share_test(void)
+{
+  int i, pid, xstatus, fd, fd2, n, ready[2], go[2];
+  char c, rfd[2], gfd[2];
+  char *argv[] = { "mmaptest", "share", rfd, gfd, 0 };
+  const char * const f = "mmaptest.cp";
+  struct stat st;
+  struct pstat ps;
+
+  printf("share_test starting\n");
+  testname = "share_test";
+
+  // a copy of this program, to overwrite later.
+  unlink(f);
+  if((fd = open("mmaptest", O_RDONLY)) == -1 || (fd2 = open(f, O_RDWR | O_CREATE)) == -1)
+    err("open");
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    if(write(fd2, buf, n) != n)
+      err("write");
+  close(fd);
+
+  if(pipe(ready) < 0 || pipe(go) < 0)
+    err("pipe");
+  rfd[0] = '0' + ready[1];
+  gfd[0] = '0' + go[0];
+  rfd[1] = gfd[1] = 0;
+  for(i = 0; i < NSHARE; i++){
+    if((pid = fork()) < 0)
+      err("fork");
+    if(pid == 0){
+      close(go[1]);
+      exec((char*)f, argv);
+      exit(2);
+    }
+  }
+  for(i = 0; i < NSHARE; i++)
+    if(read(ready[0], &c, 1) != 1)
+      err("child did not start");
+
+  getpinfo(&ps);
+  printf("%d processes running %s: %d image pages mapped %d times, %d pages saved\n",
+         NSHARE, f, ps.imgpages, ps.imgmaps, ps.imgmaps - ps.imgpages);
+  if(ps.imgmaps - ps.imgpages < NSHARE - 1)
+    err("program code not shared");
+
+  // zero the program file while the children still run it.
+  if(fstat(fd2, &st) == -1)
+    err("fstat");
+  close(fd2);
+  if((fd = open(f, O_WRONLY)) == -1)
+    err("open");
+  memset(buf, 0, sizeof(buf));
+  for(i = 0; i < st.size; i += sizeof(buf))
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      err("write");
+  close(fd);
+
+  close(go[1]);
+  for(i = 0; i < NSHARE; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      err("code of a running program changed");
+  }
+  close(go[0]);
+  close(ready[0]);
+  close(ready[1]);
+  unlink(f);
+
+  printf("share_test OK\n");
+}
+
+// qemu's memory (-m in the Makefile), in pages.
+#define RAMPAGES (128*1024*1024/PGSIZE)
+
+//
+// a child uses more memory than there is, half heap and half
+// anonymous mapping: the pages it does not use go to swap and
+// come back intact. a grandchild forked with part of them in
+// swap gets its own copy.
+//
+void
+swap_test(void)
+{
+  int i, n, pid, xstatus, used0;
+  char *h, *m;
+  struct pstat ps;
+
+  printf("swap_test starting\n");
+  testname = "swap_test";
+
+  getpinfo(&ps);
+  if(ps.swapsize == 0){
+    printf("swap_test: no swap disk, skipped\n");
+    return;
+  }
+  used0 = ps.swapused + ps.zswapused;
+  n = (RAMPAGES + ps.swapsize/4) / 2;
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if((h = sbrk(n*PGSIZE)) == (char*)-1)
+      exit(1);
+    m = mmap(0, n*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m == MAP_FAILED)
+      exit(1);
+    for(i = 0; i < n; i++){
+      *(int*)(h + i*PGSIZE) = i;
+      *(int*)(m + i*PGSIZE + PGSIZE - sizeof(int)) = ~i;
+    }
+    for(i = 0; i < n; i++)
+      if(*(int*)(h + i*PGSIZE) != i || *(int*)(m + i*PGSIZE + PGSIZE - sizeof(int)) != ~i)
+        exit(2);
+
+    // keep the first pages of the heap, which the verification
+    // above was done with long ago, and share them with a child.
+    if(munmap(m, n*PGSIZE) == -1 || sbrk(-(n - NADVISE)*PGSIZE) == (char*)-1)
+      exit(3);
+    if((pid = fork()) < 0)
+      exit(4);
+    if(pid == 0){
+      for(i = 0; i < NADVISE; i++){
+        if(*(int*)(h + i*PGSIZE) != i)
+          exit(5);
+        *(int*)(h + i*PGSIZE) = -i;
+      }
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+    for(i = 0; i < NADVISE; i++)
+      if(*(int*)(h + i*PGSIZE) != i)
+        exit(6);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus == 1)
+    err("out of memory in spite of swap");
+  if(xstatus != 0)
+    err("page corrupted by swap");
+
+  getpinfo(&ps);
+  printf("%d pages used, %d swapped out, %d swapped in\n", 2*n,
+         ps.swapouts + ps.zswapouts, ps.swapins + ps.zswapins);
+  if(ps.swapouts + ps.zswapouts == 0 || ps.swapins + ps.zswapins == 0)
+    err("nothing went through swap");
+  // idle pages of the other processes (this one included) may
+  // still be in swap, but not thousands of the child's.
+  if(ps.swapused + ps.zswapused - used0 > 4*NADVISE)
+    err("swap slots leaked");
+
+  printf("swap_test OK\n");
+}
+
+//
+// the TLB must forget PTEs that change under a running process.
+// write to private mappings, one page and more than TLBFLUSHMAX
+// pages (flushed page by page and all at once), so their writable
+// entries are in the TLB, then fork: the parent's writes must now
+// copy the pages, not reach the child's. and once unmapped, a
+// page mapped again at the same address must read as zeros.
+//
+void
+tlb_test(void)
+{
+  int i, n, pid, xstatus;
+  char *p;
+
+  printf("tlb_test starting\n");
+  testname = "tlb_test";
+
+  for(n = 1; n <= 2*TLBFLUSHMAX; n += 2*TLBFLUSHMAX - 1){
+    p = mmap(0, n*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+      err("mmap");
+    for(i = 0; i < n; i++)
+      p[i*PGSIZE] = 'a';
+    if((pid = fork()) < 0)
+      err("fork");
+    if(pid == 0){
+      sleep(1);
+      for(i = 0; i < n; i++)
+        if(p[i*PGSIZE] != 'a')
+          exit(1);
+      exit(0);
+    }
+    for(i = 0; i < n; i++)
+      p[i*PGSIZE] = 'b';
+    wait(&xstatus);
+    if(xstatus != 0)
+      err("parent wrote into the child's pages");
+    for(i = 0; i < n; i++)
+      if(p[i*PGSIZE] != 'b')
+        err("parent lost its writes");
+
+    if(munmap(p, n*PGSIZE) == -1)
+      err("munmap");
+    p = mmap(0, n*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+      err("mmap");
+    for(i = 0; i < n; i++)
+      if(p[i*PGSIZE] != 0)
+        err("stale page after munmap");
+    if(munmap(p, n*PGSIZE) == -1)
+      err("munmap");
+  }
+
+  printf("tlb_test OK\n");
+}
+
+//
+// a syscall-heavy loop over a working set of TLBPAGES pages: each
+// round makes a system call and then touches every page. if going
+// back to user space threw the TLB away, every round would pay for
+// TLBPAGES refills on top of what the system call and the touches
+// cost on their own. report that overhead, and check that system
+// calls that change no PTEs don't flush the TLB.
+//
+#define TLBPAGES 64
+#define TLBROUNDS 20000
+
+static uint
+touch(volatile char *p)
+{
+  uint sum = 0;
+
+  for(int i = 0; i < TLBPAGES; i++)
+    sum += p[i*PGSIZE];
+  return sum;
+}
+
+void
+tlb_bench(void)
+{
+  int i, r, t, tsys, ttouch, tboth, flushes;
+  uint sum = 0;
+  char *p;
+  struct pstat ps;
+
+  printf("tlb_bench starting\n");
+  testname = "tlb_bench";
+
+  p = mmap(0, TLBPAGES*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  for(i = 0; i < TLBPAGES; i++)
+    p[i*PGSIZE] = i;
+
+  t = uptime();
+  for(r = 0; r < TLBROUNDS; r++)
+    getpid();
+  tsys = uptime() - t;
+
+  t = uptime();
+  for(r = 0; r < TLBROUNDS; r++)
+    sum += touch(p);
+  ttouch = uptime() - t;
+
+  getpinfo(&ps);
+  flushes = ps.tlbflushes;
+  t = uptime();
+  for(r = 0; r < TLBROUNDS; r++){
+    getpid();
+    sum += touch(p);
+  }
+  tboth = uptime() - t;
+  getpinfo(&ps);
+  flushes = ps.tlbflushes - flushes;
+
+  if(munmap(p, TLBPAGES*PGSIZE) == -1)
+    err("munmap");
+
+  printf("%d rounds: getpid() %d ticks, %d page touches %d ticks, both %d ticks\n",
+         TLBROUNDS, tsys, TLBPAGES, ttouch, tboth);
+  printf("TLB refill overhead %d ticks, %d TLB flushes, %d ASIDs (sum %d)\n",
+         tboth - tsys - ttouch, flushes, ps.asids, sum);
+  // timer interrupts and other processes flush now and then,
+  // but not once per system call.
+  if(ps.asids > 0 && flushes > TLBROUNDS/4)
+    err("system calls flush the TLB");
+
+  printf("tlb_bench OK\n");
+}
+
+//
+// reading untouched anonymous memory maps the shared zero page
+// instead of a page each; the first write to a page gives it a
+// page of its own, and a forked child shares the zero page too.
+//
+void
+zero_test(void)
+{
+  int i, pid, xstatus, maps0;
+  char *p;
+  struct pstat ps;
+
+  printf("zero_test starting\n");
+  testname = "zero_test";
+
+  getpinfo(&ps);
+  maps0 = ps.zeromaps;
+  p = mmap(0, NADVISE*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  for(i = 0; i < NADVISE; i++)
+    if(p[i*PGSIZE] != 0 || p[i*PGSIZE + PGSIZE - 1] != 0)
+      err("untouched page not zero");
+  getpinfo(&ps);
+  if(ps.zeromaps - maps0 != NADVISE)
+    err("reads did not map the zero page");
+
+  p[0] = 'a';
+  getpinfo(&ps);
+  if(ps.zeromaps - maps0 != NADVISE - 1)
+    err("write did not copy the zero page");
+  if(p[0] != 'a' || p[PGSIZE] != 0)
+    err("zero page changed");
+
+  // the child maps the zero page wherever this process does.
+  maps0 = ps.zeromaps;
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    getpinfo(&ps);
+    if(ps.zeromaps - maps0 < NADVISE - 1)
+      exit(1);
+    p[PGSIZE] = 'b';
+    if(p[PGSIZE] != 'b' || p[2*PGSIZE] != 0 || p[0] != 'a')
+      exit(2);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child does not share the zero page");
+  if(p[PGSIZE] != 0)
+    err("child wrote into the zero page");
+
+  if(munmap(p, NADVISE*PGSIZE) == -1)
+    err("munmap");
+  getpinfo(&ps);
+  if(ps.zeromaps != maps0 - (NADVISE - 1))
+    err("zero page mappings leaked");
+
+  printf("zero_test OK\n");
+}
+
+struct memstat ms;
+
+// return the memory use of this process.
+struct procmem *
+mymem(void)
+{
+  int pid = getpid();
+
+  if(memstat(&ms) < 0)
+    err("memstat");
+  for(int i = 0; i < NPROC; i++)
+    if(ms.proc[i].pid == pid && ms.proc[i].known)
+      return &ms.proc[i];
+  err("memstat: no such process");
+  return 0;
+}
+
+//
+// memstat() counts the pages a process has resident, which of
+// them are anonymous and which are shared with another process.
+//
+void
+memstat_test(void)
+{
+  int i, pid, xstatus, rss0, anon0, shared0;
+  char *p;
+  struct procmem *m;
+
+  printf("memstat_test starting\n");
+  testname = "memstat_test";
+
+  // the first call brings in the pages of ms.
+  mymem();
+  m = mymem();
+  rss0 = m->rss;
+  anon0 = m->anon;
+  if(ms.total <= 0 || ms.free <= 0 || ms.free > ms.total || m->ptpages < 3)
+    err("bad summary");
+
+  p = mmap(0, 16*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  for(i = 0; i < 16; i++)
+    p[i*PGSIZE] = i;
+  m = mymem();
+  if(m->rss - rss0 != 16 || m->anon - anon0 != 16)
+    err("written pages not counted");
+  shared0 = m->shared;
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    // the child shares the 16 pages with the parent until it writes.
+    if(mymem()->shared - shared0 < 16)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("COW pages not counted as shared");
+
+  if(munmap(p, 16*PGSIZE) == -1)
+    err("munmap");
+  m = mymem();
+  if(m->rss != rss0)
+    err("unmapped pages still counted");
+
+  printf("memstat_test OK\n");
+}
+
+//
+// every user PTE that maps a page has an entry in the reverse
+// map: writing pages adds them, fork() adds the child's, and
+// munmap() and exit() take them out again.
+//
+void
+rmap_test(void)
+{
+  int i, pid, xstatus, r1;
+  char *p;
+
+  printf("rmap_test starting\n");
+  testname = "rmap_test";
+
+  p = mmap(0, 16*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  mymem();
+  for(i = 0; i < 16; i++)
+    p[i*PGSIZE] = i;
+  mymem();
+  r1 = ms.rmaps;
+  if(r1 < 16 || ms.rmapbytes <= 0)
+    err("bad reverse map summary");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    // the child maps the 16 pages, shared with the parent, too.
+    mymem();
+    if(ms.rmaps < r1 + 16)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child PTEs not in the reverse map");
+
+  if(munmap(p, 16*PGSIZE) == -1)
+    err("munmap");
+  mymem();
+  if(ms.rmaps != r1 - 16)
+    err("reverse map entries leaked");
+
+  printf("rmap_test OK\n");
+}
+
+#define NRECLAIM 64
+
+//
+// when free memory drops below the low watermark, the reclaim
+// thread takes pages back: here it may unmap the clean pages of
+// a file mapping, which must then read the same again.
+//
+void
+reclaim_test(void)
+{
+  int i, j, fd, pid, xstatus, eat;
+  char *p;
+  struct pstat ps0, ps1;
+
+  printf("reclaim_test starting\n");
+  testname = "reclaim_test";
+
+  unlink("reclaimf");
+  if((fd = open("reclaimf", O_RDWR | O_CREATE)) < 0)
+    err("open");
+  for(i = 0; i < NRECLAIM; i++){
+    for(j = 0; j < PGSIZE/BSIZE; j++){
+      memset(buf, 0, BSIZE);
+      if(j == 0)
+        *(int*)buf = i;
+      if(write(fd, buf, BSIZE) != BSIZE)
+        err("write");
+    }
+  }
+  p = mmap(0, NRECLAIM*PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  close(fd);
+  for(i = 0; i < NRECLAIM; i++)
+    if(*(int*)(p + i*PGSIZE) != i)
+      err("bad mapping");
+  getpinfo(&ps0);
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    // eat memory down to below the low watermark, leaving
+    // room for the page-table pages, and give the thread
+    // some ticks to react.
+    mymem();
+    eat = ms.free - ms.free/256 - RECLAIMLOW/2;
+    if(eat > 0 && sbrk(eat*PGSIZE) == (char*)-1)
+      exit(1);
+    sleep(5);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("out of memory in spite of reclaim");
+
+  getpinfo(&ps1);
+  if(ps1.reclaimed == ps0.reclaimed)
+    err("nothing reclaimed");
+  for(i = 0; i < NRECLAIM; i++)
+    if(*(int*)(p + i*PGSIZE) != i)
+      err("reclaimed page read back wrong");
+  if(munmap(p, NRECLAIM*PGSIZE) == -1)
+    err("munmap");
+  unlink("reclaimf");
+
+  printf("reclaim: %d pages freed, %d in the background, %d file pages unmapped\n",
+         ps1.reclaimed - ps0.reclaimed, ps1.bgreclaimed - ps0.bgreclaimed,
+         ps1.filedrops - ps0.filedrops);
+  printf("reclaim_test OK\n");
+}
+
+#define NKSM 32
+
+//
+// the merge thread shares identical pages of a mapping marked
+// with MADV_MERGEABLE, and writing to one copies it again.
+//
+void
+ksm_test(void)
+{
+  int i, j;
+  char *p;
+  struct pstat ps0, ps1;
+
+  printf("ksm_test starting\n");
+  testname = "ksm_test";
+
+  p = mmap(0, NKSM*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  // half the pages hold the same table, the other half are
+  // buffers that were written and zeroed again.
+  for(i = 0; i < NKSM/2; i++)
+    for(j = 0; j < PGSIZE; j++)
+      p[i*PGSIZE + j] = j % 251;
+  for(i = NKSM/2; i < NKSM; i++){
+    p[i*PGSIZE] = 1;
+    p[i*PGSIZE] = 0;
+  }
+  if(madvise(p, NKSM*PGSIZE, MADV_MERGEABLE) == -1)
+    err("madvise");
+
+  // one page of the table becomes the shared one, and
+  // every other page is merged, into it or the zero page.
+  getpinfo(&ps0);
+  if(ksmctl(1000, 1) == -1)
+    err("ksmctl");
+  for(i = 0; i < 100; i++){
+    sleep(1);
+    getpinfo(&ps1);
+    if(ps1.ksmmerged - ps0.ksmmerged >= NKSM - 1)
+      break;
+  }
+  ksmctl(KSMPAGES, KSMTICKS);
+  if(ps1.ksmmerged - ps0.ksmmerged < NKSM - 1)
+    err("pages not merged");
+  if(ps1.ksmsaved < NKSM/2 - 1)
+    err("merged pages not counted as saved");
+
+  for(i = 0; i < NKSM; i++)
+    for(j = 0; j < PGSIZE; j++)
+      if(p[i*PGSIZE + j] != (char)(i < NKSM/2 ? j % 251 : 0))
+        err("merged page changed");
+  p[0] = 7;
+  p[(NKSM-1)*PGSIZE] = 7;
+  if(p[0] != 7 || p[PGSIZE] != 0 || p[(NKSM-1)*PGSIZE] != 7 || p[(NKSM-2)*PGSIZE] != 0)
+    err("write to a merged page not copied");
+  if(munmap(p, NKSM*PGSIZE) == -1)
+    err("munmap");
+
+  printf("ksm: %d pages merged, %d saved\n", ps1.ksmmerged - ps0.ksmmerged, ps1.ksmsaved);
+  printf("ksm_test OK\n");
+}
+
+//
+// mremap() grows a mapping where it is when there is room above
+// it, and otherwise moves its PTEs elsewhere: the pages it had
+// are neither copied nor faulted in again.
+//
+void
+mremap_test(void)
+{
+  int i, faults;
+  char *a, *b, *c, *n, *h;
+
+  printf("mremap_test starting\n");
+  testname = "mremap_test";
+
+  // grow in place, into the hole that munmap() leaves above.
+  a = mmap(0, 8*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(a == MAP_FAILED)
+    err("mmap");
+  for(i = 0; i < 4; i++)
+    a[i*PGSIZE] = 'a' + i;
+  if(munmap(a + 4*PGSIZE, 4*PGSIZE) == -1)
+    err("munmap");
+  if(mremap(a, 4*PGSIZE, 8*PGSIZE, 0) != a)
+    err("grow in place");
+  for(i = 0; i < 4; i++)
+    if(a[i*PGSIZE] != 'a' + i)
+      err("page changed growing in place");
+  a[7*PGSIZE] = 'z';
+
+  // b sits right above c, so c can only grow by moving.
+  b = mmap(0, 4*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  c = mmap(0, 4*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(b == MAP_FAILED || c == MAP_FAILED || c + 4*PGSIZE != b)
+    err("mmap");
+  for(i = 0; i < 4; i++)
+    c[i*PGSIZE] = 'c' + i;
+  if(mremap(c, 4*PGSIZE, 16*PGSIZE, 0) != MAP_FAILED)
+    err("grew over another mapping");
+  faults = myfaults();
+  if((n = mremap(c, 4*PGSIZE, 16*PGSIZE, MREMAP_MAYMOVE)) == MAP_FAILED || n == c)
+    err("move");
+  for(i = 0; i < 4; i++)
+    if(n[i*PGSIZE] != 'c' + i)
+      err("page changed by the move");
+  if(myfaults() != faults)
+    err("moved pages faulted in again");
+  n[15*PGSIZE] = 'z';
+  if(mremap(c, 4*PGSIZE, 8*PGSIZE, MREMAP_MAYMOVE) != MAP_FAILED)
+    err("old range still mapped");
+
+  // shrink: the tail goes away, and the head stays.
+  if(mremap(n, 16*PGSIZE, 2*PGSIZE, 0) != n || n[PGSIZE] != 'c' + 1)
+    err("shrink");
+  if(mremap(n + 2*PGSIZE, PGSIZE, 2*PGSIZE, 0) != MAP_FAILED)
+    err("shrunk tail still mapped");
+
+  if(munmap(a, 8*PGSIZE) == -1 || munmap(b, 4*PGSIZE) == -1 || munmap(n, 2*PGSIZE) == -1)
+    err("munmap");
+
+  // the program image lies under the stack and the heap, which
+  // are not mappings: its pages can't grow into them, nor move.
+  if((h = sbrk(PGSIZE)) == (char*)-1)
+    err("sbrk");
+  h[0] = 'h';
+  i = PGROUNDUP((uint64)h + PGSIZE) - PGROUNDDOWN((uint64)buf);
+  if(mremap((char*)PGROUNDDOWN((uint64)buf), PGSIZE, i, 0) != MAP_FAILED)
+    err("image grew into the heap");
+  if(mremap((char*)PGROUNDDOWN((uint64)buf), PGSIZE, i, MREMAP_MAYMOVE) != MAP_FAILED)
+    err("image moved");
+  if(h[0] != 'h')
+    err("heap changed");
+  sbrk(-PGSIZE);
+  printf("mremap_test OK\n");
+}
+
+//
+// a child uses as much memory as there is, in pages that compress
+// well: with or without a swap disk, the ones it doesn't use go to
+// the compressed pool and come back intact.
+//
+void
+zswap_test(void)
+{
+  int i, j, n, pid, xstatus, outs0, ins0;
+  int *h;
+  struct pstat ps;
+
+  printf("zswap_test starting\n");
+  testname = "zswap_test";
+
+  getpinfo(&ps);
+  outs0 = ps.zswapouts;
+  ins0 = ps.zswapins;
+  n = RAMPAGES;
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if((h = (int*)sbrk(n*PGSIZE)) == (int*)-1)
+      exit(1);
+    // a pattern with a period that isn't a power of two, then zeros.
+    for(i = 0; i < n; i++)
+      for(j = 0; j < 64; j++)
+        h[i*(PGSIZE/sizeof(int)) + j] = i*31 + j%13;
+    // most of them are in the pool now, each in a small part of a page.
+    if(getpinfo(&ps) < 0 || ps.zswapused < 4*ps.zswappages)
+      exit(3);
+    for(i = 0; i < n; i++){
+      for(j = 0; j < 64; j++)
+        if(h[i*(PGSIZE/sizeof(int)) + j] != i*31 + j%13)
+          exit(2);
+      if(h[i*(PGSIZE/sizeof(int)) + 64] != 0 || h[(i+1)*(PGSIZE/sizeof(int)) - 1] != 0)
+        exit(2);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus == 1)
+    err("out of memory in spite of zswap");
+  if(xstatus == 3)
+    err("pages badly compressed");
+  if(xstatus != 0)
+    err("page corrupted by zswap");
+
+  getpinfo(&ps);
+  printf("%d pages compressed, %d decompressed in %d us each (%d us from disk)\n",
+         ps.zswapouts - outs0, ps.zswapins - ins0, ps.zswapinlat, ps.swapinlat);
+  if(ps.zswapouts == outs0 || ps.zswapins == ins0)
+    err("nothing went through zswap");
+
+  printf("zswap_test OK\n");
+}
+
+#define NUMAPAGES 2048
+#define NUMAROUNDS 8
+
+//
+// allocate memory from each NUMA node in turn, with mempolicy(),
+// then from the node of the hart the process runs on, and report
+// how fast pages are allocated and written on each. the pages must
+// come from the node asked for. run with make NUMA=1 qemu.
+//
+void
+numa_bench(void)
+{
+  int i, r, node, t0, talloc, ttouch, free0;
+  char *h;
+  struct pstat ps;
+
+  printf("numa_bench starting\n");
+  testname = "numa_bench";
+
+  getpinfo(&ps);
+  if(ps.numanodes < 2){
+    printf("numa_bench: one NUMA node, skipped\n");
+    return;
+  }
+
+  for(node = 0; node <= ps.numanodes; node++){
+    // the last round: the node of the hart.
+    if(mempolicy(node == ps.numanodes ? -1 : node) < 0)
+      err("mempolicy");
+    talloc = ttouch = 0;
+    for(r = 0; r < NUMAROUNDS; r++){
+      getpinfo(&ps);
+      free0 = ps.nodefree[node % ps.numanodes];
+      t0 = uptime();
+      if((h = sbrk(NUMAPAGES*PGSIZE)) == (char*)-1)
+        err("sbrk");
+      talloc += uptime() - t0;
+      getpinfo(&ps);
+      if(node < ps.numanodes && free0 - ps.nodefree[node] < NUMAPAGES/2)
+        err("pages not from the node asked for");
+
+      t0 = uptime();
+      for(i = 0; i < NUMAPAGES*PGSIZE; i += 64)
+        h[i] = i;
+      ttouch += uptime() - t0;
+      if(sbrk(-NUMAPAGES*PGSIZE) == (char*)-1)
+        err("sbrk");
+    }
+    if(node < ps.numanodes)
+      printf("node %d: ", node);
+    else
+      printf("local node: ");
+    printf("%d pages allocated in %d ticks, written in %d ticks\n",
+           NUMAROUNDS*NUMAPAGES, talloc, ttouch);
+  }
+  if(mempolicy(ps.numanodes) != -1)
+    err("mempolicy accepts a node that doesn't exist");
+  mempolicy(-1);
+
+  getpinfo(&ps);
+  printf("%d pages allocated from another node than the one wanted\n", ps.remoteallocs);
+  printf("numa_bench OK\n");
+}
+
+#define EXITPAGES 4096
+
+//
+// the pages a process unmaps, and those it still has when it
+// exits, go back to the free lists, a batch at a time. report
+// how long the exit of a large process takes.
+//
+void
+exitfree_test(void)
+{
+  int i, pid, xstatus, free0, t0, t, fds[2];
+  char *h, *m, c;
+
+  printf("exitfree_test starting\n");
+  testname = "exitfree_test";
+
+  // the first call brings in the pages of ms.
+  mymem();
+  mymem();
+  free0 = ms.free;
+  if(pipe(fds) < 0)
+    err("pipe");
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    close(fds[0]);
+    if((h = sbrk(EXITPAGES*PGSIZE)) == (char*)-1)
+      exit(1);
+    m = mmap(0, EXITPAGES*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m == MAP_FAILED)
+      exit(1);
+    for(i = 0; i < EXITPAGES; i++){
+      h[i*PGSIZE] = i;
+      m[i*PGSIZE] = i;
+    }
+    mymem();
+    t = ms.free;
+    if(munmap(m, EXITPAGES/2*PGSIZE) == -1)
+      exit(2);
+    mymem();
+    if(ms.free - t < EXITPAGES/2 - 16)
+      exit(3);
+    // the rest go when it exits.
+    write(fds[1], "x", 1);
+    exit(0);
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1)
+    err("read");
+  t0 = uptime();
+  wait(&xstatus);
+  t = uptime() - t0;
+  close(fds[0]);
+  if(xstatus == 1)
+    err("out of memory");
+  if(xstatus == 3)
+    err("unmapped pages not freed");
+  if(xstatus != 0)
+    err("munmap");
+
+  mymem();
+  printf("exit of a process with %d pages took %d ticks\n", EXITPAGES*3/2, t);
+  if(ms.free < free0 - 64)
+    err("pages of the child not freed");
+
+  printf("exitfree_test OK\n");
+}
+
+#define SPAWNS 200
+
+//
+// fork() takes the page-table pages of the child mostly from the
+// cache of zeroed ones, and exit() leaves its page tables to the
+// reaper. report how long fork+exit+wait takes, and check that
+// the page-table pages come back.
+//
+void
+ptcache_bench(void)
+{
+  int i, pid, xstatus, free0, hits, misses, t0, t;
+  struct pstat ps;
+
+  printf("ptcache_bench starting\n");
+  testname = "ptcache_bench";
+
+  mymem();
+  mymem();
+  free0 = ms.free;
+  getpinfo(&ps);
+  hits = ps.pthits;
+  misses = ps.ptmisses;
+
+  t0 = uptime();
+  for(i = 0; i < SPAWNS; i++){
+    if((pid = fork()) < 0)
+      err("fork");
+    if(pid == 0)
+      exit(0);
+    if(wait(&xstatus) != pid || xstatus != 0)
+      err("wait");
+  }
+  t = uptime() - t0;
+
+  // give the reaper a tick to free the last page tables.
+  sleep(2);
+  mymem();
+  getpinfo(&ps);
+  hits = ps.pthits - hits;
+  misses = ps.ptmisses - misses;
+  printf("%d fork+exit+wait took %d ticks, page-table pages: %d from the cache, %d allocated\n",
+         SPAWNS, t, hits, misses);
+  if(ms.free + ps.ptcached < free0 - 16)
+    err("page-table pages not freed");
+  if(hits + misses == 0)
+    err("no page-table pages allocated");
+
+  printf("ptcache_bench OK\n");
+}
+
+#define SHAREFILES (NPCACHE/BENCHPAGES + 1)
+
+//
+// two processes share mappings of more file pages than the page
+// cache has slots to begin with. each must see the other's writes
+// all the same, and so must read().
+//
+void
+bigshare_test(void)
+{
+  int i, j, pid, status, fd[SHAREFILES], tochild[2], toparent[2];
+  char *p[SHAREFILES], name[8], c;
+
+  printf("bigshare_test starting\n");
+  testname = "bigshare_test";
+
+  strcpy(name, "share0");
+  for(i = 0; i < SHAREFILES; i++){
+    name[5] = '0' + i;
+    makebig(name);
+    if((fd[i] = open(name, O_RDWR)) == -1)
+      err("open");
+    p[i] = mmap(0, BENCHPAGES*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd[i], 0);
+    if(p[i] == MAP_FAILED)
+      err("mmap");
+  }
+  if(pipe(tochild) < 0 || pipe(toparent) < 0)
+    err("pipe");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    for(i = 0; i < SHAREFILES; i++)
+      for(j = 0; j < BENCHPAGES; j++)
+        p[i][j*PGSIZE] = j + 1;
+    if(write(toparent[1], "w", 1) != 1)
+      err("write pipe (child)");
+    // keep the mappings until the parent has looked at them.
+    if(read(tochild[0], &c, 1) != 1)
+      err("read pipe (child)");
+    exit(0);
+  }
+
+  if(read(toparent[0], &c, 1) != 1)
+    err("read pipe");
+  for(i = 0; i < SHAREFILES; i++)
+    for(j = 0; j < BENCHPAGES; j++)
+      if(p[i][j*PGSIZE] != (char)(j + 1))
+        err("shared mapping does not share pages");
+  if(read(fd[SHAREFILES-1], &c, 1) != 1 || c != 1)
+    err("read() does not see mapping writes");
+  if(write(tochild[1], "x", 1) != 1)
+    err("write pipe");
+  wait(&status);
+  if(status != 0)
+    err("child");
+
+  for(i = 0; i < SHAREFILES; i++){
+    munmap(p[i], BENCHPAGES*PGSIZE);
+    close(fd[i]);
+    name[5] = '0' + i;
+    unlink(name);
+  }
+  close(tochild[0]);
+  close(tochild[1]);
+  close(toparent[0]);
+  close(toparent[1]);
+
+  printf("bigshare_test OK\n");
+}
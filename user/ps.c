@@ -0,0 +1,116 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/pstat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// ps: the physical memory that each process uses, how much
+// of the system's is used, free and cached, in KiB, and of each
+// NUMA node's, what the compressed swap pool holds, and what the
+// reverse map costs.
+
+#define KIB(pages) ((pages) * (PGSIZE / 1024))
+
+// Print s, blank-padded on the right to w characters.
+void
+left(char *s, int w)
+{
+  int n = strlen(s);
+
+  printf("%s", s);
+  while(n++ < w)
+    printf(" ");
+}
+
+// Print n, blank-padded on the left to w characters.
+void
+right(int n, int w)
+{
+  char buf[16];
+  int i = sizeof(buf) - 1, neg = n < 0;
+
+  buf[i] = 0;
+  if(neg)
+    n = -n;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n > 0);
+  if(neg)
+    buf[--i] = '-';
+  while((int)sizeof(buf) - 1 - i < w)
+    buf[--i] = ' ';
+  printf("%s", buf + i);
+}
+
+struct memstat ms;
+struct pstat ps;
+
+int
+main(int argc, char *argv[])
+{
+  struct procmem *m;
+  int i, used;
+
+  if(argc != 1){
+    printf("Don't use arguments\n");
+    exit(1);
+  }
+  if(memstat(&ms) < 0 || getpinfo(&ps) < 0){
+    printf("ps: can't get memory statistics\n");
+    exit(1);
+  }
+
+  printf("PID   NAME                RSS    ANON    FILE  SHARED    SWAP      PT\n");
+  for(i = 0; i < NPROC; i++){
+    m = &ms.proc[i];
+    if(m->pid == 0)
+      continue;
+    right(m->pid, 3);
+    printf("   ");
+    left(m->name, 16);
+    if(!m->known){
+      printf("  (busy)\n");
+      continue;
+    }
+    right(KIB(m->rss), 7);
+    right(KIB(m->anon), 8);
+    right(KIB(m->file), 8);
+    right(KIB(m->shared), 8);
+    right(KIB(m->swapped), 8);
+    right(KIB(m->ptpages), 8);
+    printf("\n");
+  }
+
+  used = ms.total - ms.free;
+  printf("\n           total      used      free    cached\n");
+  printf("Mem:  ");
+  right(KIB(ms.total), 10);
+  right(KIB(used), 10);
+  right(KIB(ms.free), 10);
+  right(KIB(ms.cached), 10);
+  printf("\nSwap: ");
+  right(KIB(ps.swapsize), 10);
+  right(KIB(ps.swapused), 10);
+  right(KIB(ps.swapsize - ps.swapused), 10);
+  printf("\n");
+  if(ps.numanodes > 1){
+    for(i = 0; i < ps.numanodes; i++){
+      printf("Node%d:", i);
+      right(KIB(ps.nodepages[i]), 10);
+      right(KIB(ps.nodepages[i] - ps.nodefree[i]), 10);
+      right(KIB(ps.nodefree[i]), 10);
+      printf("\n");
+    }
+  }
+  printf("\nZswap: %d KiB compressed into %d KiB", KIB(ps.zswapused), KIB(ps.zswappages));
+  if(ps.zswappages > 0)
+    printf(" (%d.%d:1)", ps.zswapused / ps.zswappages, ps.zswapused * 10 / ps.zswappages % 10);
+  printf("\nSwap-in latency: %d us from zswap, %d us from disk\n", ps.zswapinlat, ps.swapinlat);
+  printf("Reverse map: %d PTEs, %d KiB\n", ms.rmaps, ms.rmapbytes / 1024);
+  printf("Page tables: %d KiB cached, %d hits, %d misses, %d reaped\n",
+         KIB(ps.ptcached), ps.pthits, ps.ptmisses, ps.ptreaped);
+  exit(0);
+}
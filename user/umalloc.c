@@ -2,6 +2,8 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/proc.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
@@ -21,12 +23,23 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
+// Blocks of at least MMAP_THRESHOLD bytes get their own anonymous
+// mapping instead of coming from the sbrk heap, so free() can give
+// the pages back to the kernel. Their header has MMAPPED set in
+// s.size, next to the size of the whole mapping in units.
+#define MMAP_THRESHOLD (64*1024)
+#define MMAPPED 0x80000000
+
 void
 free(void *ap)
 {
   Header *bp, *p;
 
   bp = (Header*)ap - 1;
+  if(bp->s.size & MMAPPED){
+    munmap(bp, (bp->s.size & ~MMAPPED) * sizeof(Header));
+    return;
+  }
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -60,12 +73,29 @@ morecore(uint nu)
   return freep;
 }
 
+static void*
+mmapalloc(uint nbytes)
+{
+  Header *hp;
+  uint len;
+
+  len = PGROUNDUP(nbytes + sizeof(Header));
+  hp = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(hp == (Header*)-1)
+    return 0;
+  hp->s.size = (len / sizeof(Header)) | MMAPPED;
+  return (void*)(hp + 1);
+}
+
 void*
 malloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
 
+  if(nbytes >= MMAP_THRESHOLD && (p = mmapalloc(nbytes)) != 0)
+    return p;
+
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
@@ -3,6 +3,7 @@
 
 struct stat;
 struct pstat;
+struct memstat;
 
 // system calls
 int fork(void);
@@ -30,6 +31,12 @@ int settickets(int);
 int getpinfo(struct pstat *);
 void *mmap(void *addr, int length, int prot, int flags, int fd, int offset);
 int munmap(void *addr, int length);
+void *mremap(void *old, int oldlen, int newlen, int flags);
+int msync(void *addr, int length, int flags);
+int madvise(void *addr, int length, int advice);
+int memstat(struct memstat *);
+int ksmctl(int pages, int interval);
+int mempolicy(int node);
 
 // ulib.c
 int stat(const char*, struct stat*);
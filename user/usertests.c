@@ -2404,7 +2404,8 @@ void argptest(char *s)
 }
 
 // check that there's an invalid page beneath
-// the user stack, to catch stack overflow.
+// the user stack, once it has grown as far as
+// it can, to catch stack overflow.
 void
 stacktest(char *s)
 {
@@ -2414,7 +2415,7 @@ stacktest(char *s)
   pid = fork();
   if(pid == 0) {
     char *sp = (char *) r_sp();
-    sp -= USERSTACK*PGSIZE;
+    sp -= USERSTACKMAX*PGSIZE;
     // the *sp should cause a trap.
     printf("%s: stacktest: read below stack %d\n", s, *sp);
     exit(1);
@@ -2429,6 +2430,50 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// check that the user stack grows on demand, for
+// deep recursion and for big buffers on the stack,
+// and that fork() copies the grown stack.
+int
+stackrecurse(int n)
+{
+  volatile char buf[512];
+
+  buf[0] = buf[sizeof(buf)-1] = n;
+  if(n == 0)
+    return 0;
+  return stackrecurse(n - 1) + (buf[0] == buf[sizeof(buf)-1]);
+}
+
+void
+stackgrow(char *s)
+{
+  int pid;
+  int xstatus;
+
+  pid = fork();
+  if(pid == 0) {
+    // some 20 pages of stack.
+    if(stackrecurse(128) != 128)
+      exit(1);
+    char *sp = (char *) r_sp();
+    // a write far below sp, near the bottom of the stack region.
+    sp[-(USERSTACKMAX-2)*PGSIZE] = 'x';
+    pid = fork();
+    if(pid == 0)
+      exit(sp[-(USERSTACKMAX-2)*PGSIZE] == 'x' ? 0 : 1);
+    wait(&xstatus);
+    exit(xstatus);
+  } else if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: stack did not grow\n", s);
+    exit(1);
+  }
+}
+
 // check that writes to a few forbidden addresses
 // cause a fault, e.g. process's text and TRAMPOLINE.
 void
@@ -2644,6 +2689,7 @@ struct test {
   {bigargtest, "bigargtest"},
   {argptest, "argptest"},
   {stacktest, "stacktest"},
+  {stackgrow, "stackgrow"},
   {nowrite, "nowrite"},
   {pgbug, "pgbug" },
   {sbrkbugs, "sbrkbugs" },
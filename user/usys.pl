@@ -39,4 +39,10 @@ entry("close");
 entry("settickets");
 entry("getpinfo");
 entry("mmap");
-entry("munmap");
\ No newline at end of file
+entry("munmap");
+entry("msync");
+entry("madvise");
+entry("memstat");
+entry("ksmctl");
+entry("mremap");
+entry("mempolicy");
\ No newline at end of file